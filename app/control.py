@@ -34,6 +34,17 @@ def send_grabber(state):
         return message
     return "WebSocket not connected."
 
+def send_batch(picks, drops):
+    # picks and drops are lists of (x, y, color) with color "grey", "black" or None
+    if ws and ws.sock and ws.sock.connected:
+        def points(items):
+            return [dict({"x": float(x), "y": float(y)}, **({"color": color} if color else {}))
+                    for x, y, color in items]
+        message = json.dumps({"type": "batch", "picks": points(picks), "drops": points(drops)})
+        ws.send(message)
+        return message
+    return "WebSocket not connected."
+
 def message_handler(ws, message):
     send_signal(message)
 
@@ -4,6 +4,18 @@ import numpy as np
 from threading import Thread
 from queue import Queue
 
+def parse_crop(part_headers):
+    # Passthrough frames arrive uncropped with an "X-Crop: x,y,w,h" part header
+    start = part_headers.rfind(b"X-Crop:")
+    if start == -1:
+        return None
+    end = part_headers.find(b"\r\n", start)
+    try:
+        x, y, w, h = (int(v) for v in part_headers[start + 7:end].split(b","))
+    except ValueError:
+        return None
+    return x, y, w, h
+
 class MJPEGStreamReader(Thread):
     def __init__(self, url, queue_size=2):
         super().__init__()
@@ -23,9 +35,13 @@ class MJPEGStreamReader(Thread):
                 a = bytes_.find(b'\xff\xd8')
                 b = bytes_.find(b'\xff\xd9')
                 if a != -1 and b != -1:
+                    crop = parse_crop(bytes_[:a])
                     jpg = bytes_[a:b+2]
                     bytes_ = bytes_[b+2:]
                     frame = cv2.imdecode(np.frombuffer(jpg, dtype=np.uint8), cv2.IMREAD_COLOR)
+                    if frame is not None and crop is not None:
+                        x, y, w, h = crop
+                        frame = frame[y:y+h, x:x+w]
                     if frame is not None and not self.buffer.full():
                         self.buffer.put(frame)
         except Exception as e:
@@ -38,3 +54,34 @@ class MJPEGStreamReader(Thread):
 
     def stop(self):
         self.running = False
+
+class SnapshotReader:
+    """Pulls single frames from /snapshot.jpg only when asked for one.
+
+    Uses the frame ETag so an unchanged frame costs a 304 instead of a JPEG.
+    """
+    def __init__(self, url, timeout=2.0):
+        self.url = url
+        self.timeout = timeout
+        self.session = requests.Session()
+        self.etag = None
+
+    def get_frame(self):
+        headers = {"If-None-Match": self.etag} if self.etag else {}
+        try:
+            response = self.session.get(self.url, headers=headers, timeout=self.timeout)
+        except requests.RequestException as e:
+            print(f"[ERROR] Snapshot error: {e}")
+            return None
+        if response.status_code != 200:
+            return None  # 304: nothing new since the last frame
+        self.etag = response.headers.get("ETag")
+        frame = cv2.imdecode(np.frombuffer(response.content, dtype=np.uint8), cv2.IMREAD_COLOR)
+        crop = parse_crop(f"X-Crop: {response.headers['X-Crop']}\r\n".encode()) if "X-Crop" in response.headers else None
+        if frame is not None and crop is not None:
+            x, y, w, h = crop
+            frame = frame[y:y+h, x:x+w]
+        return frame
+
+    def stop(self):
+        self.session.close()
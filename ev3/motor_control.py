@@ -1,13 +1,43 @@
 import socket
+import struct
+import threading
 from ev3dev2.motor import Motor, OUTPUT_A, OUTPUT_B, OUTPUT_C, SpeedNativeUnits
 from time import time, sleep
 from math import pi, sin
+try:
+    import queue
+except ImportError:
+    import Queue as queue
 
 s = socket.socket()
 s.bind(('0.0.0.0', 1234))
 s.listen(5)
 conn, _ = s.accept()
 
+send_lock = threading.Lock()
+
+class StopSignal(object):
+    # STOP bumps the generation; a command only runs in the generation it was
+    # queued in, so nothing has to be cleared and no thread waits on another
+    def __init__(self):
+        self.generation = 0   # Only the reader thread bumps it
+        self.running = 0
+
+    def stop(self):
+        self.generation += 1
+
+    def begin(self, generation):
+        self.running = generation
+
+    def is_set(self):
+        return self.running != self.generation
+
+abort = StopSignal()   # Set by STOP, ends the current move early
+
+def send_line(text):
+    with send_lock:
+        conn.sendall((text + "\n").encode())
+
 def clip(value, min_value, max_value):
     return max(min(value, max_value), min_value)
 
@@ -171,7 +201,7 @@ def lerp_both_motors(m1, m2, angle1, angle2, m3):
 
     start_time = time()
     duration = max(abs(distance1) / m1.max_speed, abs(distance2) / m2.max_speed)
-    while time() <= start_time + duration:
+    while duration > 0 and time() <= start_time + duration and not abort.is_set():
         progress = (time() - start_time) / duration
         progress = smooth_lerp(progress)
         
@@ -192,6 +222,75 @@ def lerp_both_motors(m1, m2, angle1, angle2, m3):
     m3.stop()
     sleep(0.2)
 
+class SetpointFollower:
+    # Follows the joint setpoints the Pi streams between commands. Each new
+    # setpoint is eased into over the time since the previous one arrived,
+    # so the arm moves smoothly even when packets come in unevenly.
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.previous = None
+        self.latest = None
+        self.received = 0
+        self.interval = 0.02
+        self.moving = False
+
+    def push(self, angle1, angle2):
+        target = (angle1, angle1 + angle2)  # m2 is rotationally linked to m1
+        with self.lock:
+            now = time()
+            if self.latest is None or now - self.received > 0.5:
+                self.previous = (m1.get_link_position(), m2.get_link_position())
+            else:
+                self.previous = self.current(now)
+                self.interval = clip(now - self.received, 0.01, 0.2)
+            self.latest = target
+            self.received = now
+
+    def push_velocity(self, speed1, speed2):
+        # Jogging: head for where the speeds would take the arm by the next
+        # packet. If packets stop, the arm stops there rather than running on.
+        with self.lock:
+            now = time()
+            if self.latest is None or now - self.received > 0.5:
+                start = (m1.get_link_position(), m2.get_link_position())
+                send_line("POS {:.2f} {:.2f}".format(start[0], start[1] - start[0]))
+            else:
+                start = self.current(now)
+                self.interval = clip(now - self.received, 0.01, 0.2)
+            self.previous = start
+            self.latest = (start[0] + speed1 * self.interval,
+                           start[1] + (speed1 + speed2) * self.interval)   # m2 is rotationally linked to m1
+            self.received = now
+
+    def current(self, now):
+        progress = clip((now - self.received) / self.interval, 0, 1)
+        return tuple(p + (l - p) * progress for p, l in zip(self.previous, self.latest))
+
+    def clear(self):
+        with self.lock:
+            self.latest = None
+
+    def step(self):
+        # One control update, called whenever no command is running
+        with self.lock:
+            now = time()
+            fresh = self.latest is not None and now - self.received < 0.25
+            if fresh:
+                target1, target2 = self.current(now)
+        if not fresh:
+            if self.moving:
+                stop_motors()
+                self.moving = False
+            return
+        m1.set_link_target(target1)
+        m2.set_link_target(target2)
+        m1.update()
+        m2.update()
+        m3.on(m2.speed / m2.ratio)
+        self.moving = True
+
+follower = SetpointFollower()
+
 def simple_test():
     p1 = [30, -100, 0]
     p2 = [20, -70, 0]
@@ -214,40 +313,249 @@ m3 = Grabber(OUTPUT_C, 'normal')
 conn.sendall(b"Resetting grabber\n")
 m3.release()
 
-conn.sendall(b"RDY\n")
+def parse_step(text):
+    # "MOTOR a b" / "GRABBER on|off" -> the tuple run_step expects
+    parts = text.split()
+    if parts and parts[0] == 'MOTOR':
+        return ('MOTOR', float(parts[1]), float(parts[2]))
+    elif parts and parts[0] == 'GRABBER':
+        return ('GRABBER', parts[1])
+    return ('?', text)
+
+def run_step(step):
+    # Executes one MOTOR/GRABBER step, returns None or an error message
+    if step[0] == 'MOTOR':
+        lerp_both_motors(m1, m2, step[1], step[2], m3)
+        return "stopped" if abort.is_set() else None
+    elif step[0] == 'GRABBER':
+        if step[1] == "on":
+            m3.grab()
+        elif step[1] == "off":
+            m3.release()
+        else:
+            return "Wrong grabber state"
+        return None
+    return "Unknown command"
+
+def shutdown():
+    abort.begin(abort.generation)
+    lerp_both_motors(m1, m2, 0, 0, m3)
+    # Stop the motor
+    m1.motor.off()
+    m2.motor.off()
+    m3.relax()
+    m3.motor.off()
+
+def stop_motors():
+    # Hold position
+    m1.stop()
+    m2.stop()
+    m3.stop()
 
-try:
+def legacy_loop(cmd):
+    # One command at a time, each answered with a bare OK
     while True:
+        if cmd.startswith('MOTOR') or cmd.startswith('GRABBER'):
+            error = run_step(parse_step(cmd))
+            send_line("OK" if error is None else error)
+
+        elif cmd == 'STOP':
+            # No reply expected
+            stop_motors()
+
+        elif cmd == 'SHUTDOWN':
+            shutdown()
+            break
+
         cmd = conn_file.readline().strip()
 
-        if cmd.startswith('MOTOR'):
-            _, outA, outB = cmd.split()
-            outA = float(outA)
-            outB = float(outB)
-
-            lerp_both_motors(m1, m2, outA, outB, m3)
-            conn.sendall(b"OK\n")
-
-        elif cmd.startswith('GRABBER'):
-            _, state = cmd.split()
-            if state == "on":
-                m3.grab()
-                conn.sendall(b"OK\n")
-            elif state == "off":
-                m3.release()
-                conn.sendall(b"OK\n")
-            else:
-                conn.sendall(b"Wrong grabber state\n")
+def flush_commands(commands):
+    # STOP drops everything still queued, and says so
+    abort.stop()
+    follower.clear()
+    while True:
+        try:
+            pending = commands.get_nowait()
+        except queue.Empty:
+            break
+        if pending == 'SHUTDOWN':
+            commands.put(pending)
+            break
+        send_line("ERR {} stopped".format(pending[0]))
 
+def sequenced_reader(commands):
+    # Reads "<seq> CMD" lines so STOP is seen while a move is running
+    while True:
+        cmd = conn_file.readline()
+        if not cmd:
+            commands.put('SHUTDOWN')
+            break
+        cmd = cmd.strip()
+        if cmd == 'STOP':
+            flush_commands(commands)
+            continue
+        if cmd == 'SHUTDOWN':
+            commands.put(cmd)
+            break
+        if cmd.startswith('SP '):
+            parts = cmd.split()
+            follower.push(float(parts[1]), float(parts[2]))
+            continue
+        if cmd.startswith('VEL '):
+            parts = cmd.split()
+            follower.push_velocity(float(parts[1]), float(parts[2]))
+            continue
+        try:
+            seq, body = cmd.split(None, 1)
+        except ValueError:
+            send_line("ERR 0 malformed")
+            continue
+        if body.startswith('PLAN'):
+            steps = [parse_step(step) for step in body[4:].split(';') if step.strip()]
+        else:
+            steps = [parse_step(body)]
+        commands.put((seq, steps, abort.generation))
+
+# Binary command frames, see include/ev3_frame.hpp on the Pi:
+# magic u8 | version u8 | opcode u8 | steps u8 | seq u32 | length u16 | payload | crc16 u16
+FRAME_MAGIC = 0xE3
+FRAME_VERSION = 1
+FRAME_HEADER = struct.Struct('<BBBBIH')
+FRAME_MOTOR = struct.Struct('<ii')
+OP_MOTOR, OP_GRABBER, OP_STOP, OP_SHUTDOWN, OP_PLAN, OP_SETPOINT, OP_VELOCITY = 1, 2, 3, 4, 5, 6, 7
+
+def make_crc_table():
+    table = []
+    for byte in range(256):
+        crc = byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+        table.append(crc & 0xFFFF)
+    return table
+
+CRC_TABLE = make_crc_table()
+
+def crc16_ccitt(data):
+    crc = 0xFFFF
+    for byte in bytearray(data):
+        crc = ((crc << 8) & 0xFFFF) ^ CRC_TABLE[(crc >> 8) ^ byte]
+    return crc
+
+def read_exact(stream, size):
+    data = stream.read(size)
+    if data is None or len(data) < size:
+        raise EOFError()
+    return data
+
+def decode_step(op, payload, offset):
+    # Returns (step, new offset)
+    if op == OP_MOTOR:
+        a, b = FRAME_MOTOR.unpack_from(payload, offset)
+        return ('MOTOR', a / 1000.0, b / 1000.0), offset + FRAME_MOTOR.size
+    elif op == OP_GRABBER:
+        state = "on" if bytearray(payload)[offset] else "off"
+        return ('GRABBER', state), offset + 1
+    raise ValueError("opcode {}".format(op))
+
+def binary_reader(commands):
+    # Same as sequenced_reader, for frames instead of lines
+    stream = conn.makefile('rb')
+    try:
+        while True:
+            # Skip to the next magic byte if we lost sync
+            first = read_exact(stream, 1)
+            if bytearray(first)[0] != FRAME_MAGIC:
+                continue
+            header = first + read_exact(stream, FRAME_HEADER.size - 1)
+            _, version, op, count, seq, length = FRAME_HEADER.unpack(header)
+            payload = read_exact(stream, length)
+            crc, = struct.unpack('<H', read_exact(stream, 2))
+            if version != FRAME_VERSION or crc != crc16_ccitt(header + payload):
+                send_line("ERR {} bad frame".format(seq))
+                continue
+
+            if op == OP_STOP:
+                flush_commands(commands)
+                continue
+            if op == OP_SHUTDOWN:
+                break
+            if op == OP_SETPOINT:
+                a, b = FRAME_MOTOR.unpack_from(payload, 0)
+                follower.push(a / 1000.0, b / 1000.0)
+                continue
+            if op == OP_VELOCITY:
+                a, b = FRAME_MOTOR.unpack_from(payload, 0)
+                follower.push_velocity(a / 1000.0, b / 1000.0)
+                continue
+            try:
+                steps = []
+                if op == OP_PLAN:
+                    offset = 0
+                    for _ in range(count):
+                        step, offset = decode_step(bytearray(payload)[offset], payload, offset + 1)
+                        steps.append(step)
+                else:
+                    step, _ = decode_step(op, payload, 0)
+                    steps.append(step)
+            except (ValueError, IndexError, struct.error) as e:
+                send_line("ERR {} {}".format(seq, e))
+                continue
+            commands.put((str(seq), steps, abort.generation))
+    except EOFError:
+        pass
+    commands.put('SHUTDOWN')
+
+def sequenced_loop(binary):
+    # Commands are queued as they arrive and acked by sequence number,
+    # so the Pi can keep several in flight. PLAN carries several steps
+    # and gets one ack when the last step is done.
+    commands = queue.Queue()
+    reader = threading.Thread(target=binary_reader if binary else sequenced_reader, args=(commands,))
+    reader.daemon = True
+    reader.start()
 
-        elif cmd == 'SHUTDOWN':
-            lerp_both_motors(m1, m2, 0, 0, m3)
-            # Stop the motor
-            m1.motor.off()
-            m2.motor.off()
-            m3.relax()
-            m3.motor.off()
+    while True:
+        try:
+            cmd = commands.get(timeout=1.0 / m1.update_frequency)
+        except queue.Empty:
+            follower.step()
+            continue
+        if cmd == 'SHUTDOWN':
+            shutdown()
             break
+        follower.clear()
+        seq, steps, generation = cmd
+        # A command queued before a STOP is already stopped
+        abort.begin(generation)
+
+        error = None
+        for step in steps:
+            if abort.is_set():
+                break
+            error = run_step(step)
+            if error is not None:
+                break
+        if abort.is_set():
+            stop_motors()
+            error = error or "stopped"
+
+        if error is None:
+            send_line("OK " + seq)
+        else:
+            send_line("ERR {} {}".format(seq, error))
+
+# Advertise what this script speaks on top of the plain protocol
+FEATURES = ('SEQ', 'BIN1', 'SP', 'VEL')
+send_line("RDY " + " ".join(FEATURES))
+
+try:
+    cmd = conn_file.readline().strip()
+    requested = cmd.split()[1:]
+    if cmd.startswith('PROTO ') and 'SEQ' in requested and all(f in FEATURES for f in requested):
+        send_line(cmd)
+        sequenced_loop('BIN1' in requested)
+    else:
+        legacy_loop(cmd)
 except Exception as e:
     error_msg = "ERROR: " + str(e) + "\n"
     conn.sendall(error_msg.encode())
@@ -1,4 +1,9 @@
 #pragma once
+#include "constants.hpp"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 
 constexpr double PI = 3.141592;
 
@@ -17,4 +22,158 @@ public:
     KSolver(double L1, double L2, double offset);
     bool calculateIK(double targetX, double targetY, double& outA, double& outB);
     void calculateFK(double& targetX, double& targetY, double outA, double outB);
-};
\ No newline at end of file
+
+    // Joint speeds (deg/s) that move the gripper at (vx, vy) cm/s from joint
+    // angles a, b (degrees), through the inverse of the FK Jacobian. False at
+    // the stretched-out singularity, where no such speeds exist.
+    bool calculateJointVelocity(double a, double b, double vx, double vy, double& outVA, double& outVB) const;
+
+    // Batch versions over structure-of-arrays spans, see ik_batch below.
+    // Angles are in degrees on both sides, like the rest of the arm code.
+    void calculateIK(const double* xs, const double* ys, size_t n, double* outA, double* outB, uint8_t* reachable) const;
+    void calculateFK(const double* as, const double* bs, size_t n, double* xs, double* ys) const;
+};
+
+// ---- Vectorisable math ----
+// Branch-free polynomial kernels, so loops over them compile to SIMD.
+// Worst-case error against std:: on their domains: fast_acos 2e-8 rad,
+// fast_atan2 1e-5 rad, fast_sin 6e-8.
+
+inline double fast_acos(double x) {
+    // Abramowitz & Stegun 4.4.46, for |x| <= 1
+    double ax = std::fabs(x);
+    double p = -0.0012624911;
+    p = p * ax + 0.0066700901;
+    p = p * ax - 0.0170881256;
+    p = p * ax + 0.0308918810;
+    p = p * ax - 0.0501743046;
+    p = p * ax + 0.0889789874;
+    p = p * ax - 0.2145988016;
+    p = p * ax + 1.5707963050;
+    double r = std::sqrt(1.0 - ax) * p;
+    return x < 0.0 ? M_PI - r : r;
+}
+
+inline double fast_atan2(double y, double x) {
+    double ax = std::fabs(x), ay = std::fabs(y);
+    double hi = ax > ay ? ax : ay;
+    double lo = ax > ay ? ay : ax;
+    double t = lo / (hi > 0.0 ? hi : 1.0);
+    double t2 = t * t;
+    // Minimax odd polynomial for atan on [0, 1]
+    double p = -0.01172120;
+    p = p * t2 + 0.05265332;
+    p = p * t2 - 0.11643287;
+    p = p * t2 + 0.19354346;
+    p = p * t2 - 0.33262347;
+    p = p * t2 + 0.99997726;
+    double r = p * t;
+    r = ay > ax ? M_PI_2 - r : r;
+    r = x < 0.0 ? M_PI - r : r;
+    return y < 0.0 ? -r : r;
+}
+
+inline double fast_sin(double x) {
+    // Reduce to [-pi/2, pi/2], then Taylor to x^11
+    constexpr double round_magic = 6755399441055744.0;  // 1.5 * 2^52, rounds to the nearest integer
+    x -= 2.0 * M_PI * ((x * (0.5 / M_PI) + round_magic) - round_magic);
+    x = x > M_PI_2 ? M_PI - x : x;
+    x = x < -M_PI_2 ? -M_PI - x : x;
+    double x2 = x * x;
+    double p = -1.0 / 39916800.0;
+    p = p * x2 + 1.0 / 362880.0;
+    p = p * x2 - 1.0 / 5040.0;
+    p = p * x2 + 1.0 / 120.0;
+    p = p * x2 - 1.0 / 6.0;
+    p = p * x2 + 1.0;
+    return p * x;
+}
+
+inline double fast_cos(double x) {
+    return fast_sin(x + M_PI_2);
+}
+
+// ---- Batch kernels ----
+// Same formulas as KSolver::calculateIK/FK, one point per loop iteration with
+// no branches. Results stay within 2e-5 rad (about 0.001 deg) of the scalar
+// path; a target counts as reachable only if both acos arguments are in
+// range, which the scalar path doesn't check close to the base.
+
+struct IkGeometry {
+    double L1, L1_2, d2, d2_2, beta2, max_reach;
+};
+
+// Compile-time helpers for FixedKSolver, std::sqrt/atan aren't constexpr
+constexpr double ik_sqrt(double v, double guess = 1.0, int steps = 40) {
+    return steps == 0 ? guess : ik_sqrt(v, 0.5 * (guess + v / guess), steps - 1);
+}
+
+constexpr double ik_atan(double x, int halvings = 3) {
+    // Halve the angle until the series converges fast, then sum it
+    if (halvings > 0)
+        return 2.0 * ik_atan(x / (1.0 + ik_sqrt(1.0 + x * x)), halvings - 1);
+    double term = x, sum = 0.0;
+    for (int k = 1; k < 40; k += 2) {
+        sum += term / k;
+        term *= -x * x;
+    }
+    return sum;
+}
+
+inline void ik_batch(const IkGeometry& g, const double* xs, const double* ys, size_t n,
+                     double* outA, double* outB, uint8_t* reachable) {
+    constexpr double to_deg = 180.0 / PI;
+    for (size_t i = 0; i < n; ++i) {
+        double x = xs[i], y = ys[i];
+        double d1_2 = x * x + y * y;
+        double d1 = std::sqrt(d1_2);
+        double ca = (d1_2 + g.L1_2 - g.d2_2) / (2 * d1 * g.L1);
+        double cb = (g.d2_2 + g.L1_2 - d1_2) / (2 * g.d2 * g.L1);
+        bool ok = (d1 <= g.max_reach) & (std::fabs(ca) <= 1.0) & (std::fabs(cb) <= 1.0);
+        ca = ca < -1.0 ? -1.0 : (ca > 1.0 ? 1.0 : ca);
+        cb = cb < -1.0 ? -1.0 : (cb > 1.0 ? 1.0 : cb);
+
+        double heading = fast_atan2(x, y);    // relative to the y axis
+        double a = heading - fast_acos(ca);
+        double b = PI - fast_acos(cb) - g.beta2;
+        // Out of reach: point the arm at the target, like the scalar path
+        outA[i] = (ok ? a : heading) * to_deg;
+        outB[i] = (ok ? b : -g.beta2) * to_deg;
+        reachable[i] = ok;
+    }
+}
+
+inline void fk_batch(const IkGeometry& g, const double* as, const double* bs, size_t n, double* xs, double* ys) {
+    constexpr double to_rad = PI / 180.0;
+    for (size_t i = 0; i < n; ++i) {
+        double a = as[i] * to_rad;
+        double c = a + bs[i] * to_rad + g.beta2;
+        xs[i] = g.L1 * fast_sin(a) + g.d2 * fast_sin(c);
+        ys[i] = g.L1 * fast_cos(a) + g.d2 * fast_cos(c);
+    }
+}
+
+// Geometry fixed at compile time, every derived constant folds into the loop
+template <typename Arm>
+struct FixedKSolver {
+    static constexpr double d2_2 = Arm::L2 * Arm::L2 + Arm::offset * Arm::offset;
+    static constexpr double d2 = ik_sqrt(d2_2);
+    static constexpr IkGeometry geometry{Arm::L1, Arm::L1 * Arm::L1, d2, d2_2,
+                                         PI / 2 - ik_atan(Arm::L2 / Arm::offset), Arm::L1 + d2};
+
+    static void calculateIK(const double* xs, const double* ys, size_t n, double* outA, double* outB, uint8_t* reachable) {
+        ik_batch(geometry, xs, ys, n, outA, outB, reachable);
+    }
+
+    static void calculateFK(const double* as, const double* bs, size_t n, double* xs, double* ys) {
+        fk_batch(geometry, as, bs, n, xs, ys);
+    }
+};
+
+// The arm this program drives
+struct RobotArm {
+    static constexpr double L1 = Constants::L1;
+    static constexpr double L2 = Constants::L2;
+    static constexpr double offset = Constants::offset;
+};
+using ArmKSolver = FixedKSolver<RobotArm>;
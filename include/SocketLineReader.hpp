@@ -1,12 +1,42 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
+#include <string_view>
+#include <vector>
 
+// Splits a socket's byte stream into '\n' terminated lines.
+// Bytes land in one fixed buffer and lines are handed out as views into it,
+// so reading a line doesn't allocate. A view stays valid until the next call
+// that reads from the socket.
 class SocketLineReader {
-    std::string buffer;
-    int sockfd;
-
 public:
-    SocketLineReader(int fd);
+    enum class Status { Line, Timeout, Closed };
+
+    explicit SocketLineReader(int fd, size_t capacity = 4096);
+
+    // Blocks until a line arrives, or until timeout_ms passes (-1 waits forever)
+    Status readLine(std::string_view& out, int timeout_ms = -1);
     bool readLine(std::string& out);
-};
\ No newline at end of file
+
+    // Returns a line that is already buffered, never touches the socket
+    bool nextLine(std::string_view& out);
+    bool hasLine() const;   // A complete line is already buffered
+
+    // One recv() of whatever the socket has, for callers that poll() themselves.
+    // Returns false if the peer closed the connection.
+    bool receive();
+
+    size_t droppedBytes() const { return dropped; }
+
+private:
+    int sockfd;
+    std::vector<char> buffer;
+    size_t begin = 0;       // First unread byte
+    size_t end = 0;         // One past the last received byte
+    size_t scanned = 0;     // Bytes after begin already known to have no '\n'
+    size_t dropped = 0;     // Bytes of over-long lines thrown away
+    bool discarding = false; // Skipping to the end of an over-long line
+
+    bool findLine(std::string_view& out);
+};
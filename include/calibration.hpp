@@ -0,0 +1,32 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <array>
+#include <map>
+#include <mutex>
+
+// Pixel to table-plane mapping from the four ArUco markers around the robot.
+// The homography is cached and only recomputed when a marker centre moves
+// more than the tolerance, so a static camera costs one solve.
+class Calibration {
+public:
+    explicit Calibration(double tolerance_px);
+
+    // Detects the markers in gray and refreshes the homography if needed.
+    // Returns true when it changed.
+    bool update(const cv::Mat& gray);
+
+    bool isCalibrated() const;    // A homography exists
+    bool isFresh() const;         // ...and the markers were seen on the last update
+    bool pixelToWorld(double px, double py, double& wx, double& wy) const;
+    bool homography(std::array<double, 9>& out) const;
+
+private:
+    const double tolerance_px;
+    cv::aruco::ArucoDetector detector;
+    std::map<int, cv::Point2f> centres;   // Marker centres the cached homography was built from
+
+    mutable std::mutex mtx;               // Guards H and fresh, read from HTTP threads
+    std::array<double, 9> H{};
+    bool calibrated = false;
+    bool fresh = false;
+};
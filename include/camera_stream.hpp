@@ -1,16 +1,79 @@
 #pragma once
+#include "constants.hpp"
+#include "mpsc_queue.hpp"
 #include <nlohmann/json.hpp>
-#include <queue>
-#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
 
+struct JobStats {
+    size_t depth;           // Jobs waiting, in the ring and the ordered lane
+    uint64_t accepted;
+    uint64_t coalesced;     // coords jobs replaced by a newer target
+    uint64_t preempted;     // Jobs discarded by cancel/stop
+    uint64_t dropped;       // Jobs lost to a full queue
+    uint64_t dropped_ordered;   // Of those, jobs other than coords (grip, sequence, batch)
+};
+
+// Jobs from the WebSocket threads to the motor thread. Pushing never blocks;
+// the motor thread sleeps on an eventfd and wakes the moment a job arrives.
+//
+// Queue semantics per job type, applied when the motor thread takes jobs:
+//  - consecutive "coords" jobs collapse to the latest target
+//  - "grip" jobs are never merged and keep their place in order; when the
+//    lane overflows the oldest coords go first, and only a lane with no
+//    coords left loses its oldest job of another type (dropped_ordered)
+//  - "cancel"/"stop" bypass the queue and discard everything queued before them
 class JobHandler {
 public:
+    JobHandler();
+    ~JobHandler();
+
     // Read-only access
-    bool readLastJob(nlohmann::json &job);
-    void addJob(nlohmann::json job);
+    // received is when the WebSocket delivered it, empty unless tracing
+    bool readLastJob(nlohmann::json &job, std::chrono::steady_clock::time_point* received = nullptr);
+    bool addJob(nlohmann::json job);     // False when the queue is full
+
+    // Block until a job is available or wake() is called
+    bool waitForJob(nlohmann::json &job);
+    void wake();                          // async-signal-safe
+    int eventFd() const { return event_fd; }
+
+    bool takeStopRequest() { return stop_requested.exchange(false); }
+
+    // Latest joystick vector, sampled by the motor thread every control tick.
+    // Only going from centred to tilted wakes it, the rest is just a store.
+    void setJog(int angle, int distance);
+    bool readJog(int& angle, int& distance) const;    // False when centred
+
+    JobStats stats() const;
 
 private:
-    std::queue<nlohmann::json> job_queue;
+    struct QueuedJob {
+        nlohmann::json job;
+        uint64_t epoch = 0;               // cancel_epoch when it was queued
+        std::chrono::steady_clock::time_point received;
+    };
+
+    void drain();
+
+    MpscQueue<QueuedJob, Constants::job_queue_capacity> job_queue;
+    int event_fd;
+    std::atomic<uint64_t> cancel_epoch{0};
+    std::atomic<bool> stop_requested{false};
+    std::atomic<uint32_t> jog{0};        // angle << 16 | distance, 0 when centred
+
+    // Motor thread only
+    std::deque<QueuedJob> pending;
+    uint64_t seen_epoch = 0;
+
+    std::atomic<size_t> pending_size{0};
+    std::atomic<uint64_t> accepted{0};
+    std::atomic<uint64_t> coalesced{0};
+    std::atomic<uint64_t> preempted{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> dropped_ordered{0};
 };
 
 extern JobHandler jobHandler;
@@ -19,3 +82,4 @@ extern JobHandler jobHandler;
 void start_mjpeg_server(bool stream);
 void stop_mjpeg_server();
 void send_ws_message(const std::string& msg);
+nlohmann::json job_stats_json();
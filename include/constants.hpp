@@ -1,15 +1,27 @@
 #pragma once
+#include <chrono>
+#include <cstddef>
 
 namespace Constants {
-    constexpr int control_loop_ms = 100; // Control loop interval in milliseconds
+    constexpr int control_loop_ms = 20; // Control loop interval in milliseconds
     constexpr int control_loop_hz = 1000 / control_loop_ms; // Control loop frequency in Hz
 
     // Movement constants
-    constexpr double SENSITIVITY = 0.01 / control_loop_hz; // Sensitivity for joystick movement (multiplied by joystick distance (0-100))
+    constexpr double SENSITIVITY = 0.1 / control_loop_hz; // Sensitivity for joystick movement (multiplied by joystick distance (0-100)), 10 cm/s at full tilt
+    constexpr double jog_reach_margin = 0.2;  // cm, jogging stops this far short of the fully stretched arm
     constexpr double deadzone_x_left = -7.7;
     constexpr double deadzone_x_right = 7.3;
     constexpr double deadzone_y_top = 7.0;
     constexpr double deadzone_y_bottom = -12.5;
+    constexpr double deadzone_margin = 0.5;   // Clearance kept around the deadzone by planned paths
+    constexpr double detour_spacing = 2.5;    // cm between the rings of detour waypoints, and along them
+    constexpr double workspace_cell = 0.25;   // cm, reachability grid built at startup
+
+    // Trajectory constants, setpoints are streamed every control_loop_ms
+    constexpr bool trajectory_enabled = true; // Plan straight-line moves if the EV3 script takes setpoints
+    constexpr double trajectory_max_speed = 15.0;  // Gripper speed, cm/s
+    constexpr double trajectory_max_accel = 40.0;  // Gripper acceleration, cm/s^2
+    constexpr int batch_exact_limit = 6;    // Batch jobs up to this many picks and drops are ordered exactly
 
     // IK Solver constants
     constexpr double L1 = 11.3;
@@ -17,6 +29,50 @@ namespace Constants {
     constexpr double offset = 6.0;
     constexpr double J1_limit = 180.0;
     constexpr double J2_limit = 90.0;
+    constexpr double J1_max_speed = 50.0;   // deg/s, matches max_speed of the EV3 motors
+    constexpr double J2_max_speed = 70.0;
+
+    // Camera stream constants
+    constexpr int frame_width = 1280;
+    constexpr int frame_height = 720;
+    constexpr int frame_fps = 30;
+    constexpr double stream_crop = 0.70;    // Fraction of the width kept around the center
+    constexpr int jpeg_quality = 90;
+    constexpr int jpeg_encoder_threads = 3;   // Leaves a core for capture and the motor thread
+    constexpr int max_stream_profiles = 4;    // Distinct /stream?w=&q=&crop= encodings at once
+    constexpr auto snapshot_lease = std::chrono::seconds(3); // Keep encoding a profile this long after a /snapshot.jpg
+    constexpr bool motion_gate = true;        // Only encode frames that differ from the last one sent
+    constexpr int motion_pixel_threshold = 12;        // Gray level change that counts a pixel as changed
+    constexpr double motion_changed_fraction = 0.002; // Fraction of changed pixels that counts as motion
+    constexpr auto motion_keepalive = std::chrono::seconds(2); // Send a frame at least this often
+
+    // On-Pi detection constants
+    constexpr bool detection_enabled = true;  // Publish cylinder detections on the /detections WebSocket
+    constexpr auto detection_interval = std::chrono::milliseconds(100); // At most one detection run per interval
+    constexpr const char* background_path = "background.jpg"; // Grayscale reference of the empty table, cropped like /stream
+    constexpr auto calibration_interval = std::chrono::seconds(1); // How often the ArUco markers are looked for
+    constexpr double calibration_tolerance_px = 2.0;  // Marker movement that triggers a new homography
+    constexpr double robot_zone_half = 10.0;          // Detections within this many cm of the base are ignored
+    constexpr bool mjpeg_passthrough = false; // Forward the camera's own JPEG bytes, crop is left to the client
+    constexpr bool use_v4l2_capture = true;   // Direct V4L2 mmap capture, OpenCV is the fallback
+    constexpr bool v4l2_prefer_mjpeg = true;  // USB cameras rarely reach 720p30 in YUYV
+    constexpr int v4l2_queue_depth = 2;       // Driver buffers (1-4), fewer means fresher frames
+
+    // Motor job queue constants
+    constexpr size_t job_queue_capacity = 64; // Power of two
+
+    // Logging constants
+    constexpr int log_level = 1;              // Lowest level written: 0 debug, 1 info, 2 warn, 3 error
+    constexpr size_t log_ring_records = 256;  // Per thread, power of two; a full ring drops messages
+    constexpr auto log_flush_interval = std::chrono::milliseconds(10);
+
+    // Metrics constants
+    constexpr auto metrics_trace_window = std::chrono::minutes(5); // Stage timestamps are taken this long after a /metrics scrape
+
+    // Real-time mode (--rt) constants
+    constexpr int rt_priority = 80;           // SCHED_FIFO priority of the motor thread
+    constexpr int rt_cpu = 3;                 // Core reserved for the motor thread, everything else stays off it
+    constexpr size_t rt_stack_prefault = 256 * 1024;
 
     // EV3 connection constants
     constexpr const char* EV3_IP = "10.42.0.3";
@@ -24,4 +80,9 @@ namespace Constants {
     constexpr const char* EV3_SSH_P1 = "ssh -o ConnectTimeout=5 robot@10.42.0.3 'nohup python3 ";
     constexpr const char* EV3_SSH_P2 = " > /dev/null 2>&1 &'";
     constexpr const char* EV3_SCRIPT = "motor_control.py";
+    constexpr int ev3_pipeline_window = 4;    // Sequenced commands in flight, 1 keeps stop-and-wait
+    constexpr bool ev3_binary_frames = true;  // Use binary command frames if the EV3 script supports them
+    constexpr auto ev3_ready_timeout = std::chrono::seconds(20); // RDY and PROTO replies, the script resets the grabber first
+    constexpr auto ev3_ack_timeout = std::chrono::seconds(60);   // Longest silence while commands are in flight
+    constexpr auto ev3_watchdog_period = std::chrono::seconds(1);
 }
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary framing for commands to the EV3, used instead of text lines when
+// both sides announce "BIN" during the RDY handshake. All fields are little
+// endian:
+//
+//   magic u8 | version u8 | opcode u8 | steps u8 | seq u32 | length u16 | payload | crc16 u16
+//
+// The CRC (CCITT, init 0xFFFF) covers the header and the payload. Joint angles
+// are signed millidegrees, so no float parsing is needed on the EV3.
+// Acks stay text ("OK <seq>"), they are rare compared to commands.
+
+constexpr uint8_t ev3_frame_magic = 0xE3;
+constexpr uint8_t ev3_frame_version = 1;
+constexpr size_t ev3_frame_header = 10;
+constexpr size_t ev3_frame_trailer = 2;
+
+enum class Ev3Op : uint8_t {
+    Motor = 1,      // i32 angle A, i32 angle B (millidegrees)
+    Grabber = 2,    // u8 1 = grab, 0 = release
+    Stop = 3,       // no payload, not acked
+    Shutdown = 4,   // no payload, not acked
+    Plan = 5,       // steps, each an opcode byte followed by its payload
+    Setpoint = 6,   // same payload as Motor, not acked, followed rather than run
+    Velocity = 7,   // i32 joint speed A, i32 joint speed B (millidegrees/s), not acked
+};
+
+// One thing for the EV3 to do. A command is one step, a PLAN several.
+struct Ev3Step {
+    Ev3Op op = Ev3Op::Motor;
+    double a = 0.0;     // degrees, deg/s for Velocity
+    double b = 0.0;     // degrees, deg/s for Velocity
+    bool grab = false;
+};
+
+uint16_t crc16_ccitt(const uint8_t* data, size_t size);
+
+// Appends one frame to out. Several steps are sent as a PLAN
+void encodeEv3Frame(uint32_t seq, const std::vector<Ev3Step>& steps, std::vector<uint8_t>& out);
+void encodeEv3Control(Ev3Op op, std::vector<uint8_t>& out);
+
+// Text form of the same steps, without sequence number and newline
+std::string formatEv3Text(const std::vector<Ev3Step>& steps);
@@ -0,0 +1,43 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+// Single-threaded reactor: epoll over sockets, eventfds and timerfds.
+// Handlers run on the thread that calls run(); only stop() may be called
+// from elsewhere (it is safe from a signal handler too).
+class EventLoop {
+public:
+    using Handler = std::function<void(uint32_t events)>;
+
+    EventLoop();
+    ~EventLoop();
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // events are EPOLLIN/EPOLLOUT/...; level triggered
+    bool add(int fd, uint32_t events, Handler handler);
+    bool modify(int fd, uint32_t events);
+    void remove(int fd);
+
+    // Calls tick every period until cancelled. Missed ticks are folded into
+    // one call, which gets the number of periods that passed. Returns the
+    // timer id, or -1.
+    int addTimer(std::chrono::nanoseconds period, std::function<void(uint64_t expirations)> tick);
+    void cancelTimer(int id);
+
+    void run();
+    void stop();
+    bool stopped() const { return stopping; }
+
+private:
+    int epoll_fd = -1;
+    int stop_fd = -1;
+    std::atomic<bool> stopping{false};   // Lock-free, so stop() stays signal-safe
+    std::unordered_map<int, std::shared_ptr<Handler>> handlers;
+    std::unordered_set<int> timers;
+};
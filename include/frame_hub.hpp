@@ -0,0 +1,55 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// One encoded frame, shared read-only between every client that sends it
+struct EncodedFrame {
+    uint64_t seq = 0;                                 // Monotonic frame number
+    std::chrono::steady_clock::time_point captured;   // When the frame was grabbed
+    uint32_t camera_seq = 0;                          // Sequence number from the capture backend
+    std::vector<unsigned char> jpg;                   // Encoded JPEG bytes
+    int crop_x = 0, crop_y = 0;                       // Crop the client should apply,
+    int crop_w = 0, crop_h = 0;                       // zero size when already cropped
+};
+
+using FramePtr = std::shared_ptr<const EncodedFrame>;
+
+// Recycles EncodedFrame objects, keeping their JPEG buffer capacity, so steady
+// state encoding doesn't allocate. Frames return here when the last client
+// drops its reference; the pool state outlives the pool object if needed.
+class FramePool {
+public:
+    explicit FramePool(size_t jpg_capacity);
+    std::shared_ptr<EncodedFrame> acquire();
+
+private:
+    struct State {
+        std::mutex mtx;
+        std::vector<EncodedFrame*> free;
+        size_t jpg_capacity;
+        ~State();
+    };
+    std::shared_ptr<State> state;
+};
+
+// Latest-frame slot: one producer publishes, any number of consumers wait for
+// something newer than what they already have. Consumers only hold a reference,
+// so a frame stays alive until the slowest client has finished writing it.
+class FrameHub {
+public:
+    void publish(FramePtr frame);
+    FramePtr latest();
+    // Returns a frame with seq > after_seq, or nullptr on timeout / close
+    FramePtr waitNewer(uint64_t after_seq, std::chrono::milliseconds timeout);
+    void close();
+
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    FramePtr current;
+    bool closed = false;
+};
@@ -0,0 +1,89 @@
+#pragma once
+#include "constants.hpp"
+#include "frame_hub.hpp"
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Output format of one stream
+struct StreamProfile {
+    int width = 0;                              // Output width in pixels, 0 keeps the cropped width
+    int quality = Constants::jpeg_quality;
+    double crop = Constants::stream_crop;       // Fraction of the width kept around the center
+
+    bool operator<(const StreamProfile& o) const {
+        return std::tie(width, quality, crop) < std::tie(o.width, o.quality, o.crop);
+    }
+    bool operator==(const StreamProfile& o) const {
+        return std::tie(width, quality, crop) == std::tie(o.width, o.quality, o.crop);
+    }
+};
+
+// A profile to encode a frame for, and the hub its clients read from
+struct EncodeTarget {
+    StreamProfile profile;
+    std::shared_ptr<FrameHub> hub;
+};
+
+// Decodes (if needed), crops, resizes and JPEG-encodes frames on a small worker
+// pool. A frame is decoded once and encoded once per target profile. Frames are
+// encoded in parallel but published strictly in submission order; frames are
+// dropped at submit time when every worker is busy.
+class JpegEncoderPool {
+public:
+    explicit JpegEncoderPool(int threads);
+    ~JpegEncoderPool();
+
+    // Either image (BGR) or jpeg (compressed camera frame) is used; the
+    // compressed bytes are copied, so the caller may reuse them right away.
+    bool submit(uint64_t seq, std::chrono::steady_clock::time_point captured, uint32_t camera_seq,
+                const cv::Mat& image, const unsigned char* jpeg, size_t jpeg_size,
+                const std::vector<EncodeTarget>& targets);
+    void stop();
+
+    std::shared_ptr<EncodedFrame> acquireFrame() { return frames.acquire(); }
+    uint64_t droppedFrames() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    using Output = std::vector<std::pair<std::shared_ptr<FrameHub>, FramePtr>>;
+
+    struct Slot {
+        uint64_t ticket = 0;
+        uint64_t seq = 0;
+        std::chrono::steady_clock::time_point captured;
+        uint32_t camera_seq = 0;
+        cv::Mat image;
+        std::vector<unsigned char> jpeg;   // Reused input buffer for compressed frames
+        std::vector<EncodeTarget> targets;
+    };
+
+    void worker();
+    void encode(Slot& slot, Output& out);
+    void complete(uint64_t ticket, Output out);
+
+    FramePool frames;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<Slot> slots;
+    std::vector<int> free_slots;
+    std::deque<int> work;                  // Slots waiting for a worker, oldest first
+    std::vector<std::thread> workers;
+    bool stopping = false;
+    uint64_t next_ticket = 0;
+    std::atomic<uint64_t> dropped{0};     // Read from other threads without the lock
+
+    // Reorder step: finished frames wait here until all earlier ones are out
+    std::mutex reorder_mtx;
+    std::map<uint64_t, Output> finished;
+    uint64_t next_out = 0;
+};
@@ -0,0 +1,120 @@
+#pragma once
+#include "constants.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+enum class LogLevel : uint8_t { Debug, Info, Warn, Error };
+
+// One message as the calling thread left it: a literal format with "{}"
+// placeholders and its arguments packed as tagged binary values. Turning it
+// into text is left to the drain thread.
+struct LogRecord {
+    static constexpr size_t payload_size = 224;
+
+    uint64_t timestamp_ns;      // CLOCK_REALTIME
+    const char* format;         // Must outlive the logger, i.e. a string literal
+    LogLevel level;
+    uint8_t size;               // Payload bytes in use
+    uint8_t payload[payload_size];
+};
+
+// Lock-free logging for threads that must not block. Every thread writes to
+// its own single-producer ring; a background thread drains all of them every
+// log_flush_ms, orders the batch by timestamp, formats it and writes it out.
+// When a ring is full the message is dropped and counted, never waited for.
+class Logger {
+public:
+    Logger();
+    ~Logger();
+
+    template <typename... Args>
+    void write(LogLevel level, const char* format, const Args&... args);
+
+    // Writes out everything queued so far and stops the drain thread. Later
+    // messages go straight to stdout/stderr.
+    void stop();
+
+    uint64_t dropped() const;
+
+private:
+    struct Ring;
+
+    Ring* ring();                           // This thread's, created on first use
+    bool reserve(Ring*& ring, LogRecord*& record);
+    void commit(Ring* ring, const LogRecord& record);
+    void drainLoop();
+    size_t drainOnce(std::vector<LogRecord>& batch, std::string& text);
+    static void format(const LogRecord& record, std::string& out);
+    static void output(const LogRecord& record, const std::string& line);
+
+    static void put(LogRecord& r, uint8_t tag, const void* data, size_t size);
+    template <typename T>
+    static void putArg(LogRecord& r, const T& value);
+
+    std::mutex rings_mutex;                 // Only for adding and removing rings, never on write()
+    std::vector<std::shared_ptr<Ring>> rings;
+    std::atomic<bool> running{true};
+    std::atomic<uint64_t> dropped_total{0};
+    std::thread drain_thread;
+};
+
+Logger& logger();
+
+template <typename T>
+void Logger::putArg(LogRecord& r, const T& value) {
+    if constexpr (std::is_same_v<T, bool>) {
+        uint8_t b = value;
+        put(r, 'b', &b, 1);
+    } else if constexpr (std::is_same_v<T, char>) {
+        put(r, 'c', &value, 1);
+    } else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+        if constexpr (std::is_signed_v<T> || std::is_enum_v<T>) {
+            int64_t v = static_cast<int64_t>(value);
+            put(r, 'i', &v, sizeof(v));
+        } else {
+            uint64_t v = value;
+            put(r, 'u', &v, sizeof(v));
+        }
+    } else if constexpr (std::is_floating_point_v<T>) {
+        double v = value;
+        put(r, 'd', &v, sizeof(v));
+    } else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+        // Copied, the caller's string may be gone by the time it is formatted
+        std::string_view s = value;
+        put(r, 's', s.data(), s.size());
+    } else {
+        static_assert(std::is_same_v<T, void>, "Unsupported log argument type");
+    }
+}
+
+template <typename... Args>
+void Logger::write(LogLevel level, const char* format, const Args&... args) {
+    if (static_cast<int>(level) < Constants::log_level)
+        return;
+    Ring* ring = nullptr;
+    LogRecord* record = nullptr;
+    if (!reserve(ring, record))
+        return;
+    record->level = level;
+    record->format = format;
+    record->size = 0;
+    (putArg(*record, args), ...);
+    commit(ring, *record);
+}
+
+template <typename... Args>
+void logDebug(const char* format, const Args&... args) { logger().write(LogLevel::Debug, format, args...); }
+template <typename... Args>
+void logInfo(const char* format, const Args&... args) { logger().write(LogLevel::Info, format, args...); }
+template <typename... Args>
+void logWarn(const char* format, const Args&... args) { logger().write(LogLevel::Warn, format, args...); }
+template <typename... Args>
+void logError(const char* format, const Args&... args) { logger().write(LogLevel::Error, format, args...); }
@@ -0,0 +1,85 @@
+#pragma once
+#include "latency_histogram.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <time.h>
+
+// Points a frame or a job passes on its way, each with a latency histogram.
+// Together they split "cylinder seen" to "arm there" into its parts.
+enum class TraceStage {
+    Capture,        // Driver timestamp to the frame reaching user space
+    Encode,         // Capture to JPEG ready for clients
+    StreamSend,     // Capture to written to an MJPEG client
+    JobQueue,       // WebSocket receipt to taken off the queue by motorLoop
+    Ik,             // Turning a job into EV3 steps, IK included
+    Ev3Send,        // WebSocket receipt to the command going out to the EV3
+    Ev3Done,        // Command sent to its ack: network, the EV3 queue and the move itself
+    JobTotal,       // WebSocket receipt to the ack
+    Count
+};
+
+enum class TraceCounter {
+    FramesCaptured,
+    FramesEncoded,
+    FramesSent,
+    JobsReceived,
+    JobsUnreachable,
+    Ev3Commands,
+    Ev3Acks,
+    Ev3Errors,
+    Count
+};
+
+// Counters are always kept, a relaxed add each. Timestamps and histograms
+// are only taken while tracing(), i.e. for a while after the last scrape of
+// /metrics, so without a scraper the hot paths skip the clock reads too.
+class Metrics {
+public:
+    using clock = std::chrono::steady_clock;
+
+    bool tracing() const {
+        return trace_until.load(std::memory_order_relaxed) > coarseMs();
+    }
+
+    // Start time for a later since(), left empty when not tracing
+    clock::time_point stamp() const { return tracing() ? clock::now() : clock::time_point(); }
+
+    void record(TraceStage stage, clock::duration duration) {
+        stages[static_cast<size_t>(stage)].record(duration);
+    }
+
+    // Records the time since start, if start was taken
+    void since(TraceStage stage, clock::time_point start) {
+        if (start != clock::time_point())
+            record(stage, clock::now() - start);
+    }
+
+    void count(TraceCounter counter, uint64_t n = 1) {
+        counters[static_cast<size_t>(counter)].fetch_add(n, std::memory_order_relaxed);
+    }
+    uint64_t value(TraceCounter counter) const {
+        return counters[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+    }
+
+    // Called by the /metrics handler, keeps tracing on for a while
+    void scraped();
+
+    // Stage summaries and counters in the Prometheus text format
+    void render(std::string& out) const;
+
+private:
+    static int64_t coarseMs() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);     // vDSO read, no syscall
+        return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    std::array<LatencyHistogram, static_cast<size_t>(TraceStage::Count)> stages;
+    std::array<std::atomic<uint64_t>, static_cast<size_t>(TraceCounter::Count)> counters{};
+    std::atomic<int64_t> trace_until{0};
+};
+
+extern Metrics metrics;
@@ -0,0 +1,30 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <chrono>
+
+// Decides whether a captured frame differs enough from the last one we sent
+// to be worth encoding. Works on a small grayscale thumbnail, so the check
+// costs far less than the encode it saves.
+class MotionGate {
+public:
+    MotionGate(int pixel_threshold, double changed_fraction, std::chrono::milliseconds keepalive);
+
+    // Either image (BGR) or jpeg (compressed camera frame) is used. Returns
+    // true when the frame should be sent; that frame becomes the new reference.
+    bool shouldSend(const cv::Mat& image, const unsigned char* jpeg, size_t jpeg_size,
+                    std::chrono::steady_clock::time_point now);
+
+    // Next frame is sent regardless, e.g. when a new client needs a first frame
+    void force() { forced = true; }
+
+private:
+    bool thumbnail(const cv::Mat& image, const unsigned char* jpeg, size_t jpeg_size);
+
+    const int pixel_threshold;        // Gray level change that counts a pixel as changed
+    const double changed_fraction;    // Fraction of changed pixels that counts as motion
+    const std::chrono::milliseconds keepalive;
+
+    cv::Mat small, gray, diff, reference;
+    std::chrono::steady_clock::time_point last_sent{};
+    bool forced = true;
+};
@@ -1,12 +1,44 @@
 #pragma once
+#include "latency_histogram.hpp"
 #include <atomic>
+#include <cstdint>
 
 extern std::atomic<bool> go_shutdown;
+extern int shutdown_event;   // eventfd, readable for good once shutdown starts
+
+// What the EV3 script agreed to during the RDY handshake
+struct Ev3Protocol {
+    bool sequenced = false;   // "<seq> CMD" lines acked with "OK <seq>", several in flight
+    int window = 1;           // Commands sent before waiting for an ack
+    bool binary = false;      // Commands go out as ev3_frame.hpp frames instead of text
+    bool setpoints = false;   // Unacked "SP a b" joint setpoints between commands
+    bool velocity = false;    // Unacked "VEL a b" joint speeds, for jogging
+};
 
 bool start_ev3_script();
-int connect_to_ev3(const char* ip, int port);
+int connect_to_ev3(const char* ip, int port, Ev3Protocol& protocol);
+void send_ev3_shutdown(int sockfd, const Ev3Protocol& protocol);
 
 void resolvePointAABBCollision(double oldX, double oldY, double& newX, double& newY, double left, double top, double right, double bottom);
 float clampAngle(float angle, float limit, bool& reachable);
 void joystick_to_coordinates(int angle, int distance, double& x, double& y);
-void motorLoop(int sockfd);
\ No newline at end of file
+void motorLoop(int sockfd, Ev3Protocol protocol, bool realtime);
+
+// Timing of the control ticks that stream setpoints and jog velocities,
+// written by the motor thread and read by the /timing endpoint
+struct ControlTiming {
+    LatencyHistogram period;    // From one tick to the next
+    LatencyHistogram jitter;    // Distance of the period from control_loop_ms
+    LatencyHistogram work;      // Time spent handling a tick
+    std::atomic<uint64_t> overruns{0};  // Ticks missed entirely
+    std::atomic<bool> realtime{false};  // Running with SCHED_FIFO
+
+    void reset() {
+        period.reset();
+        jitter.reset();
+        work.reset();
+        overruns.store(0, std::memory_order_relaxed);
+    }
+};
+
+extern ControlTiming control_timing;
\ No newline at end of file
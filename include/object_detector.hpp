@@ -0,0 +1,31 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+enum class CylinderColor { Grey, Black };
+
+// One cylinder found in a frame, in pixel coordinates of that frame
+struct Detection {
+    double x = 0, y = 0;      // Bounding box centre
+    cv::Rect bbox;
+    CylinderColor color = CylinderColor::Grey;
+};
+
+// Background subtraction + ellipse fit cylinder detector, the C++ twin of
+// Vision.detect_objects_rgb in app/vision.py.
+class ObjectDetector {
+public:
+    bool loadBackground(const std::string& path);
+    void setBackground(const cv::Mat& gray);
+    bool hasBackground() const { return !background.empty(); }
+
+    // gray must be the same size as the background
+    bool detect(const cv::Mat& gray, std::vector<Detection>& out);
+
+private:
+    cv::Mat background;
+    cv::Mat diff, thresh, mask;
+};
+
+const char* colorName(CylinderColor color);
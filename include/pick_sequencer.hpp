@@ -0,0 +1,30 @@
+#pragma once
+#include <utility>
+#include <vector>
+
+// A cylinder to pick up, or a free slot to drop one into.
+// color is a CylinderColor value, or -1 when any color will do.
+struct PickPoint {
+    double x, y;
+    int color = -1;
+};
+
+struct PickPlan {
+    std::vector<std::pair<int, int>> pairs;     // (pick index, drop index) in the order to run them
+    std::vector<int> skipped;                   // Picks left out: unreachable or no free slot
+    double travel_time = 0.0;                   // Seconds of joint travel, grip time not included
+    // Joint angles (a, b) in degrees of every pick and drop, as solved for
+    // the plan; only meaningful for the ones in pairs
+    std::vector<std::pair<double, double>> pick_angles, drop_angles;
+};
+
+// Seconds the EV3 needs to move between two joint poses (degrees). Both
+// motors run at once, motor B turning with joint A plus joint B.
+double jointTravelTime(double a0, double b0, double a1, double b1);
+
+// Chooses a slot for every pick it can and the order to run them in, so the
+// arm spends as little time travelling as possible, starting at (from_x,
+// from_y). Exact up to batch_exact_limit picks and slots, greedy beyond.
+void planPickSequence(double from_x, double from_y,
+                      const std::vector<PickPoint>& picks, const std::vector<PickPoint>& drops,
+                      PickPlan& plan);
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+
+// Opt-in deterministic mode for the motor thread (--rt). Each call needs
+// root or the matching capability (CAP_SYS_NICE, CAP_IPC_LOCK); a failure is
+// a warning and the program carries on with normal scheduling.
+
+// Keeps the calling thread, and every thread it starts afterwards, off cpu
+bool avoidCpu(int cpu);
+
+// SCHED_FIFO at priority for the calling thread, pinned to cpu
+bool makeThreadRealtime(int priority, int cpu);
+
+// Locks current and future pages in RAM so the control loop never waits on a page fault
+bool lockMemory();
+
+// Touches the stack the calling thread is going to use, while it's still cheap
+void prefaultStack(size_t bytes);
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// One sample of a planned move, in table cm and joint degrees
+struct Setpoint {
+    double t;       // Seconds since the start of the move
+    double x, y;
+    double a, b;    // Joint angles as sent to the EV3
+};
+
+// Turns a move between two table points into setpoints every dt seconds.
+// The gripper follows straight lines with a trapezoidal speed profile (the
+// fastest profile under the speed and acceleration limits). When the direct
+// line leaves the workspace map (the base deadzone, the joint limit band
+// around it, the J1 wrap behind the base), it takes the shortest detour
+// through reachable waypoints instead. If the joints can't keep up, the
+// whole move is slowed down until they can.
+class TrajectoryPlanner {
+public:
+    TrajectoryPlanner(double max_speed, double max_accel, double dt);
+
+    // Returns false if some point of the path is out of reach
+    bool plan(double from_x, double from_y, double to_x, double to_y, std::vector<Setpoint>& out);
+
+    // Straight segments from one point to another that stay on the workspace map
+    static void route(double from_x, double from_y, double to_x, double to_y, std::vector<double>& xs, std::vector<double>& ys);
+
+    // Builds the detour waypoints, else the first detour pays for it.
+    // Returns how many there are.
+    static size_t prepareDetours();
+    // Plans moves across the base in both directions, each one needs a
+    // detour. Returns how many couldn't be planned.
+    static int checkDetours();
+
+private:
+    double max_speed;   // cm/s
+    double max_accel;   // cm/s^2
+    double dt;          // s
+
+    // Path samples as arrays for the batch IK, kept to reuse their memory
+    std::vector<double> sample_t, sample_x, sample_y, sample_a, sample_b;
+    std::vector<uint8_t> sample_ok;
+
+    bool sample(const std::vector<double>& xs, const std::vector<double>& ys, double speed, double accel, std::vector<Setpoint>& out);
+};
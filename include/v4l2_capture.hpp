@@ -0,0 +1,55 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A dequeued camera buffer. The data points straight into the driver's mmap
+// buffer and stays valid until it is handed back with V4L2Capture::release().
+struct V4L2Frame {
+    const unsigned char* data = nullptr;
+    size_t size = 0;                                  // Bytes used in the buffer
+    uint32_t sequence = 0;                            // Driver frame counter
+    std::chrono::steady_clock::time_point timestamp;  // Kernel capture time (CLOCK_MONOTONIC)
+    int index = -1;                                   // Buffer index, for release()
+};
+
+// Minimal V4L2 streaming capture using mmap buffers, without OpenCV's internal
+// copies and buffering.
+class V4L2Capture {
+public:
+    V4L2Capture() = default;
+    ~V4L2Capture();
+    V4L2Capture(const V4L2Capture&) = delete;
+    V4L2Capture& operator=(const V4L2Capture&) = delete;
+
+    // queue_depth is clamped to 1..4; fewer buffers means fresher frames
+    bool open(const char* device, int width, int height, int fps, uint32_t fourcc, int queue_depth);
+    void close();
+    bool isOpened() const { return fd >= 0; }
+
+    // Waits up to timeout_ms and returns the newest queued frame; older
+    // frames that are already waiting are handed back to the driver.
+    bool grab(V4L2Frame& frame, int timeout_ms);
+    void release(const V4L2Frame& frame);
+
+    bool setControl(uint32_t id, int32_t value);
+
+    int width() const { return frame_width; }
+    int height() const { return frame_height; }
+    uint32_t pixelFormat() const { return pixel_format; }
+
+private:
+    struct Buffer {
+        void* start = nullptr;
+        size_t length = 0;
+    };
+
+    bool queueBuffer(int index);
+
+    int fd = -1;
+    std::vector<Buffer> buffers;
+    int frame_width = 0;
+    int frame_height = 0;
+    uint32_t pixel_format = 0;
+};
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Reachability of the table around the arm, on a grid built once at startup.
+// Each cell remembers whether targets in it can be reached (within the IK
+// reach, the joint limits and outside the base deadzone) and the joint
+// angles at its center as a seed. Cells whose corners disagree sit on the
+// edge of the workspace; only those still need an exact IK solve.
+class WorkspaceMap {
+public:
+    enum Flags : uint8_t {
+        Reachable  = 1 << 0,    // Every corner of the cell is reachable
+        Boundary   = 1 << 1,    // Corners disagree, solve exactly
+        Deadzone   = 1 << 2,    // Center is inside the base deadzone
+        OutOfReach = 1 << 3,    // Center is beyond the arm's reach
+        JointLimit = 1 << 4,    // Center needs a joint past its limit
+    };
+
+    explicit WorkspaceMap(double cell_cm);
+
+    // Exact answer; O(1) except on Boundary cells
+    bool reachable(double x, double y) const;
+    uint8_t flags(double x, double y) const;    // 0 outside the grid
+    // Joint angles (degrees) at the center of the cell holding x, y
+    bool seed(double x, double y, double& a, double& b) const;
+
+    int cols() const { return grid_cols; }
+    int rows() const { return grid_rows; }
+    double cellSize() const { return cell; }
+    double originX() const { return min_x; }    // Table x of column 0's left edge
+    double originY() const { return min_y; }    // Table y of row 0's bottom edge
+    const std::vector<uint8_t>& cells() const { return cell_flags; }
+
+    // Exact check, the same one the grid is built from
+    static uint8_t classify(double x, double y, double& a, double& b);
+
+private:
+    double cell;
+    double min_x, min_y;
+    int grid_cols, grid_rows;
+    std::vector<uint8_t> cell_flags;    // Row major, row 0 at min_y
+    std::vector<float> seeds;           // a, b per cell
+
+    int index(double x, double y) const;
+};
+
+// Built on first use; main touches it at startup so no job pays for that
+const WorkspaceMap& workspaceMap();
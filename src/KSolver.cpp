@@ -38,4 +38,29 @@ void KSolver::calculateFK(double& target_X, double& target_Y, double out_A, doub
     out_B = out_B * PI / 180.0; // Convert to radians
     target_X = this->L1 * std::sin(out_A) + this->d2 * std::sin(out_A + out_B + this->beta2);
     target_Y = this->L1 * std::cos(out_A) + this->d2 * std::cos(out_A + out_B + this->beta2);
-}
\ No newline at end of file
+}
+
+bool KSolver::calculateJointVelocity(double a, double b, double vx, double vy, double& outVA, double& outVB) const {
+    a = a * PI / 180.0;
+    double c = a + b * PI / 180.0 + this->beta2;   // Direction of the second link, as in calculateFK
+    // J = [[L1 cos a + d2 cos c, d2 cos c], [-L1 sin a - d2 sin c, -d2 sin c]]
+    double det = this->L1 * this->d2 * std::sin(a - c);
+    if (std::abs(det) < 1e-6) {
+        outVA = outVB = 0.0;
+        return false;
+    }
+    double va = (-this->d2 * std::sin(c) * vx - this->d2 * std::cos(c) * vy) / det;
+    double vb = ((this->L1 * std::sin(a) + this->d2 * std::sin(c)) * vx +
+                 (this->L1 * std::cos(a) + this->d2 * std::cos(c)) * vy) / det;
+    outVA = va * 180.0 / PI;
+    outVB = vb * 180.0 / PI;
+    return true;
+}
+
+void KSolver::calculateIK(const double* xs, const double* ys, size_t n, double* outA, double* outB, uint8_t* reachable) const {
+    ik_batch({L1, L1_2, d2, d2_2, beta2, max_reach}, xs, ys, n, outA, outB, reachable);
+}
+
+void KSolver::calculateFK(const double* as, const double* bs, size_t n, double* xs, double* ys) const {
+    fk_batch({L1, L1_2, d2, d2_2, beta2, max_reach}, as, bs, n, xs, ys);
+}
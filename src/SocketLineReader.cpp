@@ -1,23 +1,99 @@
 #include "SocketLineReader.hpp"
+#include "logger.hpp"
 #include <unistd.h>     // for read(), close()
 #include <arpa/inet.h>  // for recv()
-#include <stdexcept>
+#include <poll.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
 
-SocketLineReader::SocketLineReader(int fd) : sockfd(fd) {}
+SocketLineReader::SocketLineReader(int fd, size_t capacity) : sockfd(fd), buffer(capacity) {}
 
-bool SocketLineReader::readLine(std::string& out) {
-    size_t pos;
-    while ((pos = buffer.find('\n')) == std::string::npos) {
-        char temp[128];
-        ssize_t n = recv(sockfd, temp, sizeof(temp), 0);
-        if (n <= 0) return false; // Closed or error
-        buffer.append(temp, n);
+bool SocketLineReader::findLine(std::string_view& out) {
+    while (true) {
+        const char* start = buffer.data() + begin;
+        const void* newline = std::memchr(start + scanned, '\n', end - begin - scanned);
+        if (!newline) {
+            scanned = end - begin;  // Next search starts after these bytes
+            return false;
+        }
+        size_t length = static_cast<const char*>(newline) - start;
+        begin += length + 1;
+        scanned = 0;
+        if (discarding) {
+            // Rest of a line that didn't fit
+            dropped += length + 1;
+            discarding = false;
+            continue;
+        }
+        out = std::string_view(start, length);
+        return true;
+    }
+}
+
+bool SocketLineReader::nextLine(std::string_view& out) {
+    return findLine(out);
+}
+
+bool SocketLineReader::hasLine() const {
+    return std::memchr(buffer.data() + begin + scanned, '\n', end - begin - scanned) != nullptr;
+}
+
+bool SocketLineReader::receive() {
+    // Make room: move the unread tail to the front instead of erasing per line
+    if (begin == end) {
+        begin = end = 0;
+    } else if (end == buffer.size() && begin > 0) {
+        std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+        end -= begin;
+        begin = 0;
+    }
+    if (end == buffer.size()) {
+        // A single line fills the buffer, nothing sane sends that
+        logWarn("Line longer than {} bytes dropped.", buffer.size());
+        dropped += end - begin;
+        begin = end = scanned = 0;
+        discarding = true;
     }
 
-    out = buffer.substr(0, pos);
-    buffer.erase(0, pos + 1);
+    ssize_t n;
+    do {
+        n = recv(sockfd, buffer.data() + end, buffer.size() - end, MSG_DONTWAIT);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;  // Spurious wakeup
+    if (n <= 0) return false; // Closed or error
+    end += static_cast<size_t>(n);
     return true;
 }
+
+SocketLineReader::Status SocketLineReader::readLine(std::string_view& out, int timeout_ms) {
+    using clock = std::chrono::steady_clock;
+    const auto deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    while (!findLine(out)) {
+        int wait = -1;
+        if (timeout_ms >= 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+            if (left <= 0) return Status::Timeout;
+            wait = static_cast<int>(left);
+        }
+
+        pollfd pfd{sockfd, POLLIN, 0};
+        int ready = poll(&pfd, 1, wait);
+        if (ready < 0 && errno != EINTR) return Status::Closed;
+        if (ready <= 0) continue;
+        if (!receive()) return Status::Closed;
+    }
+    return Status::Line;
+}
+
+bool SocketLineReader::readLine(std::string& out) {
+    std::string_view line;
+    if (readLine(line) != Status::Line) return false;
+    out.assign(line);
+    return true;
+}
+
 // #include "SocketLineReader.hpp"
 // #include <unistd.h>     // for read(), close()
 // #include <arpa/inet.h>  // for recv()
@@ -0,0 +1,100 @@
+#include "calibration.hpp"
+#include <cmath>
+#include <vector>
+
+// Real-world marker centres in cm, same as MARKER_WORLD_COORDS in app/vision.py
+static const std::map<int, cv::Point2f> MARKER_WORLD_COORDS = {
+    {0, {-10, 10}},
+    {1, {10, 10}},
+    {2, {-10, -10}},
+    {3, {10, -10}},
+};
+
+Calibration::Calibration(double tolerance_px)
+    : tolerance_px(tolerance_px),
+      detector(cv::aruco::getPredefinedDictionary(cv::aruco::DICT_4X4_50), cv::aruco::DetectorParameters()) {}
+
+bool Calibration::update(const cv::Mat& gray) {
+    std::vector<std::vector<cv::Point2f>> corners;
+    std::vector<int> ids;
+    detector.detectMarkers(gray, corners, ids);
+
+    std::map<int, cv::Point2f> found;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (MARKER_WORLD_COORDS.count(ids[i]) == 0)
+            continue;
+        cv::Point2f c(0, 0);
+        for (const cv::Point2f& p : corners[i]) {
+            c.x += p.x / corners[i].size();
+            c.y += p.y / corners[i].size();
+        }
+        found[ids[i]] = c;
+    }
+
+    if (found.size() < MARKER_WORLD_COORDS.size()) {
+        std::lock_guard<std::mutex> lock(mtx);
+        fresh = false;
+        return false;
+    }
+
+    // Skip the solve while every marker stays within tolerance of the cached fit
+    bool moved = centres.size() != found.size();
+    for (const auto& [id, c] : found) {
+        if (moved)
+            break;
+        const cv::Point2f& old = centres[id];
+        moved = std::hypot(c.x - old.x, c.y - old.y) > tolerance_px;
+    }
+    if (!moved) {
+        std::lock_guard<std::mutex> lock(mtx);
+        fresh = true;
+        return false;
+    }
+
+    std::vector<cv::Point2f> image_pts, world_pts;
+    for (const auto& [id, c] : found) {
+        image_pts.push_back(c);
+        world_pts.push_back(MARKER_WORLD_COORDS.at(id));
+    }
+    cv::Mat Hmat = cv::findHomography(image_pts, world_pts);
+    if (Hmat.empty())
+        return false;
+
+    centres = found;
+    std::lock_guard<std::mutex> lock(mtx);
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c)
+            H[r * 3 + c] = Hmat.at<double>(r, c);
+    }
+    calibrated = true;
+    fresh = true;
+    return true;
+}
+
+bool Calibration::isCalibrated() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return calibrated;
+}
+
+bool Calibration::isFresh() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return calibrated && fresh;
+}
+
+bool Calibration::pixelToWorld(double px, double py, double& wx, double& wy) const {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!calibrated)
+        return false;
+    double w = H[6] * px + H[7] * py + H[8];
+    if (std::abs(w) < 1e-12)
+        return false;
+    wx = (H[0] * px + H[1] * py + H[2]) / w;
+    wy = (H[3] * px + H[4] * py + H[5]) / w;
+    return true;
+}
+
+bool Calibration::homography(std::array<double, 9>& out) const {
+    std::lock_guard<std::mutex> lock(mtx);
+    out = H;
+    return calibrated;
+}
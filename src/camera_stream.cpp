@@ -1,8 +1,33 @@
 #include "camera_stream.hpp"
+#include "calibration.hpp"
+#include "constants.hpp"
+#include "frame_hub.hpp"
+#include "jpeg_encoder.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "motion_gate.hpp"
+#include "motor_control.hpp"
+#include "object_detector.hpp"
+#include "v4l2_capture.hpp"
+#include "workspace_map.hpp"
 #include <opencv2/opencv.hpp>
 #include <civetweb.h>
+#include <linux/videodev2.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
 #include <nlohmann/json.hpp>
+#include <algorithm>
 #include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
 #include <thread>
 #include <vector>
 #include <string>
@@ -12,23 +37,211 @@ using json = nlohmann::json;
 // ---- globals kept simple for a minimal demo ----
 static cv::VideoCapture cam;
 static std::atomic<bool> keep_running{true};
+static std::thread capture_thread;
+// Clients asking for the same profile share one encoded stream
+struct ProfileChannel {
+    StreamProfile profile;
+    std::shared_ptr<FrameHub> hub = std::make_shared<FrameHub>();
+    int clients = 0;                  // Guarded by profiles_mutex
+    std::chrono::steady_clock::time_point lease_until{};   // Kept alive for snapshot pollers
+
+    bool idle(std::chrono::steady_clock::time_point now) const {
+        return clients == 0 && now >= lease_until;
+    }
+};
+static std::mutex profiles_mutex;
+static std::map<StreamProfile, std::shared_ptr<ProfileChannel>> profiles;
+
+// Counters for one /stream connection
+struct StreamClientStats {
+    std::string remote;
+    StreamProfile profile;
+    double target_fps = 0;
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> dropped{0};     // Frames skipped because the client was behind
+};
+static std::mutex stream_stats_mutex;
+static std::vector<std::shared_ptr<StreamClientStats>> stream_stats;
+
+// Detection stage: the capture thread hands over the newest frame, the
+// detection thread runs ObjectDetector on it and pushes JSON to /detections
+struct DetectionInput {
+    cv::Mat image;                    // BGR frame, or empty when jpeg is used
+    std::vector<uchar> jpeg;
+    std::chrono::steady_clock::time_point captured;
+    uint32_t camera_seq = 0;
+    bool fresh = false;
+};
+static std::thread detection_thread;
+static std::mutex detection_mutex;
+static std::condition_variable detection_cv;
+static DetectionInput detection_input;
+static std::atomic<bool> update_background{false};
+static std::mutex detection_conns_mutex;
+static std::set<mg_connection*> detection_conns;
+static std::atomic<int> detection_clients{0};
+static Calibration calibration(Constants::calibration_tolerance_px);
 
 JobHandler jobHandler;
 
 static mg_connection *ws_client_conn = nullptr;  // WebSocket client connection
 static std::mutex ws_conn_mutex;
 
-bool JobHandler::readLastJob(json &job) {
-    if (!job_queue.empty()) {
-        job = job_queue.front();
-        job_queue.pop();
+JobHandler::JobHandler() {
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0) { throw std::runtime_error("eventfd failed"); }
+}
+
+JobHandler::~JobHandler() {
+    close(event_fd);
+}
+
+static bool isType(const json& job, const char* type) {
+    auto it = job.find("type");
+    return it != job.end() && it->is_string() && it->get_ref<const std::string&>() == type;
+}
+
+bool JobHandler::addJob(json job) {
+    if (!job.is_object())
+        return false;
+    if (isType(job, "cancel") || isType(job, "stop")) {
+        // Preempt: bump the epoch, everything queued under the old one is stale
+        if (isType(job, "stop"))
+            stop_requested.store(true);
+        cancel_epoch.fetch_add(1);
+        wake();
         return true;
     }
-    return false;
+    if (!job_queue.push({std::move(job), cancel_epoch.load(), metrics.stamp()})) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    accepted.fetch_add(1, std::memory_order_relaxed);
+    wake();
+    return true;
+}
+
+void JobHandler::drain() {
+    auto preempt = [&](uint64_t epoch) {
+        preempted.fetch_add(pending.size(), std::memory_order_relaxed);
+        pending.clear();
+        seen_epoch = epoch;
+    };
+
+    uint64_t epoch = cancel_epoch.load();
+    if (epoch > seen_epoch)
+        preempt(epoch);
+
+    QueuedJob q;
+    while (job_queue.pop(q)) {
+        if (q.epoch < seen_epoch) {
+            preempted.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        if (q.epoch > seen_epoch)
+            preempt(q.epoch);   // A cancel landed after our epoch check
+
+        // A newer target replaces one that hasn't been started yet
+        if (isType(q.job, "coords") && !pending.empty() && isType(pending.back().job, "coords")) {
+            pending.back() = std::move(q);
+            coalesced.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        pending.push_back(std::move(q));
+    }
+
+    // Over depth: shed the oldest coords first, grips keep their place
+    while (pending.size() > Constants::job_queue_capacity) {
+        auto it = std::find_if(pending.begin(), pending.end(),
+                               [](const QueuedJob& p) { return isType(p.job, "coords"); });
+        if (it == pending.end()) {
+            it = pending.begin();
+            dropped_ordered.fetch_add(1, std::memory_order_relaxed);
+        }
+        pending.erase(it);
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    pending_size.store(pending.size(), std::memory_order_relaxed);
+}
+
+bool JobHandler::readLastJob(json &job, std::chrono::steady_clock::time_point* received) {
+    drain();
+    if (pending.empty())
+        return false;
+    job = std::move(pending.front().job);
+    if (received)
+        *received = pending.front().received;
+    pending.pop_front();
+    pending_size.store(pending.size(), std::memory_order_relaxed);
+    return true;
 }
 
-void JobHandler::addJob(json job) {
-    job_queue.push(job);
+void JobHandler::wake() {
+    uint64_t one = 1;
+    ssize_t n = write(event_fd, &one, sizeof(one));
+    (void)n;    // Only fails when the counter is already huge, i.e. already awake
+}
+
+void JobHandler::setJog(int angle, int distance) {
+    uint32_t packed = distance > 0 ? (static_cast<uint32_t>(angle & 0xFFFF) << 16) | static_cast<uint32_t>(distance & 0xFFFF) : 0;
+    if (jog.exchange(packed, std::memory_order_relaxed) == 0 && packed != 0)
+        wake();
+}
+
+bool JobHandler::readJog(int& angle, int& distance) const {
+    uint32_t packed = jog.load(std::memory_order_relaxed);
+    angle = static_cast<int>(packed >> 16);
+    distance = static_cast<int>(packed & 0xFFFF);
+    return packed != 0;
+}
+
+bool JobHandler::waitForJob(json &job) {
+    if (readLastJob(job))
+        return true;
+
+    // Sleep until a producer (or shutdown) bumps the eventfd. A push that
+    // lands between the check above and the poll still leaves the fd readable.
+    pollfd pfd{event_fd, POLLIN, 0};
+    while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {}
+    uint64_t count;
+    ssize_t n = read(event_fd, &count, sizeof(count));
+    (void)n;
+    return readLastJob(job);
+}
+
+JobStats JobHandler::stats() const {
+    return {
+        job_queue.size() + pending_size.load(std::memory_order_relaxed),
+        accepted.load(std::memory_order_relaxed),
+        coalesced.load(std::memory_order_relaxed),
+        preempted.load(std::memory_order_relaxed),
+        dropped.load(std::memory_order_relaxed),
+        dropped_ordered.load(std::memory_order_relaxed),
+    };
+}
+
+json job_stats_json() {
+    JobStats st = jobHandler.stats();
+    return {
+        {"depth", st.depth},
+        {"accepted", st.accepted},
+        {"coalesced", st.coalesced},
+        {"preempted", st.preempted},
+        {"dropped", st.dropped},
+        {"dropped_ordered", st.dropped_ordered},
+    };
+}
+
+static int jobsHandler(struct mg_connection *conn, void * /*cbdata*/) {
+    std::string body = job_stats_json().dump();
+    mg_printf(conn,
+              "HTTP/1.1 200 OK\r\n"
+              "Content-Type: application/json\r\n"
+              "Content-Length: %zu\r\n"
+              "Connection: close\r\n\r\n",
+              body.size());
+    mg_write(conn, body.data(), body.size());
+    return 200;
 }
 
 static int wsConnect(const mg_connection* conn, void*) {
@@ -41,20 +254,38 @@ static void wsClose(const mg_connection* conn, void*) {
     std::lock_guard<std::mutex> lock(ws_conn_mutex);
     if (ws_client_conn == conn) {
         ws_client_conn = nullptr;
+        jobHandler.setJog(0, 0);    // Don't keep jogging for a client that is gone
     }
 }
 
 static int wsMessage(mg_connection *conn, int, char *data, size_t len, void*) {
+    // Joystick page: "M<deg>#<dist>" many times a second, "G1"/"G0" for the grabber
+    if (len > 1 && data[0] == 'M') {
+        int angle = 0, distance = 0;
+        const char* end = data + len;
+        auto parsed = std::from_chars(data + 1, end, angle);
+        if (parsed.ec == std::errc() && parsed.ptr < end && *parsed.ptr == '#' &&
+            std::from_chars(parsed.ptr + 1, end, distance).ec == std::errc())
+            jobHandler.setJog(angle, std::clamp(distance, 0, 100));
+        return 1;
+    }
+    if (len == 2 && data[0] == 'G' && (data[1] == '0' || data[1] == '1')) {
+        jobHandler.addJob({{"type", "grip"}, {"state", data[1] == '1' ? "on" : "off"}});
+        return 1;
+    }
+
     std::string msg(data, len);
-    std::cout<<"New job: "<< msg << "\n";
+    logInfo("New job: {}", msg);
+    metrics.count(TraceCounter::JobsReceived);
     try
     {
         json j = json::parse(msg);
-        jobHandler.addJob(j);
+        if (!jobHandler.addJob(std::move(j)))
+            logWarn("Job rejected, queue full or not an object.");
     }
     catch(const json::parse_error& e)
     {
-        std::cerr << "JSON parse error: " << e.what() << "\n";
+        logError("JSON parse error: {}", e.what());
     }
 
     return 1; // keep the connection open
@@ -67,59 +298,702 @@ void send_ws_message(const std::string& msg) {
     }
 }
 
+// One grabbed frame, whichever backend produced it
+struct CapturedFrame {
+    cv::Mat image;                    // Decoded BGR frame, empty until decoded
+    const uchar* jpeg = nullptr;      // Camera's own JPEG bytes, if it sent MJPG
+    size_t jpeg_size = 0;
+    std::chrono::steady_clock::time_point captured;
+    uint32_t sequence = 0;
+};
+
+static V4L2Capture v4l2;
+static V4L2Frame v4l2_frame;          // Held from grabFrame() until releaseFrame()
+static cv::Mat cam_frame;
+static uint32_t cam_sequence = 0;
+
+// Grab the next frame from the V4L2 backend, or from OpenCV as a fallback
+static bool grabFrame(CapturedFrame& out) {
+    out = CapturedFrame();
+    if (v4l2.isOpened()) {
+        if (!v4l2.grab(v4l2_frame, 1000))
+            return false;
+        out.captured = v4l2_frame.timestamp;
+        out.sequence = v4l2_frame.sequence;
+        if (v4l2.pixelFormat() == V4L2_PIX_FMT_MJPEG) {
+            out.jpeg = v4l2_frame.data;
+            out.jpeg_size = v4l2_frame.size;
+        } else {
+            cv::Mat yuyv(v4l2.height(), v4l2.width(), CV_8UC2, const_cast<uchar*>(v4l2_frame.data));
+            cv::cvtColor(yuyv, out.image, cv::COLOR_YUV2BGR_YUYV);
+        }
+        return true;
+    }
+
+    cam_frame.release();   // The encoder may still hold the previous frame
+    if (!cam.read(cam_frame))
+        return false;
+    out.captured = std::chrono::steady_clock::now();
+    out.sequence = cam_sequence++;
+    if (Constants::mjpeg_passthrough) {
+        out.jpeg = cam_frame.data;
+        out.jpeg_size = cam_frame.total() * cam_frame.elemSize();
+    } else {
+        out.image = cam_frame;
+    }
+    return true;
+}
+
+// Hand the camera buffer back once we are done with the frame
+static void releaseFrame() {
+    if (v4l2.isOpened())
+        v4l2.release(v4l2_frame);
+}
+
+// Profiles that currently have clients, and where to publish them. Channels
+// whose snapshot lease ran out without a stream client are dropped here.
+static void activeTargets(std::vector<EncodeTarget>& targets) {
+    targets.clear();
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(profiles_mutex);
+    for (auto it = profiles.begin(); it != profiles.end();) {
+        if (it->second->idle(now)) {
+            it = profiles.erase(it);
+            continue;
+        }
+        targets.push_back({it->first, it->second->hub});
+        ++it;
+    }
+}
+
+// Owns the camera: grabs each frame and hands it to the encoder pool, which
+// encodes it once per active profile and publishes it to that profile's hub.
+static void captureLoop() {
+    using namespace Constants;
+    CapturedFrame frame;
+    uint64_t seq = 0;
+    std::vector<EncodeTarget> targets;
+
+    JpegEncoderPool encoder(jpeg_encoder_threads);
+    MotionGate gate(motion_pixel_threshold, motion_changed_fraction, motion_keepalive);
+
+    // Compressed frames carry no geometry, so it comes from the negotiated format
+    const int raw_width = v4l2.isOpened() ? v4l2.width() : static_cast<int>(cam.get(cv::CAP_PROP_FRAME_WIDTH));
+    const int raw_height = v4l2.isOpened() ? v4l2.height() : static_cast<int>(cam.get(cv::CAP_PROP_FRAME_HEIGHT));
+
+    auto next_detection = std::chrono::steady_clock::now();
+
+    while (keep_running.load())
+    {
+        if (!grabFrame(frame))  // grab frame
+            continue;
+        const auto now = std::chrono::steady_clock::now();
+        metrics.count(TraceCounter::FramesCaptured);
+        if (metrics.tracing())
+            metrics.record(TraceStage::Capture, now - frame.captured);
+
+        // Keep draining the camera so the next viewer gets a fresh frame,
+        // but don't pay for the encode while nobody is watching
+        activeTargets(targets);
+        const bool want_detection = detection_enabled && now >= next_detection &&
+                                    detection_clients.load(std::memory_order_relaxed) > 0;
+        if (want_detection) {
+            // Latest-only handover, an unprocessed older frame is simply replaced.
+            // Ahead of the motion gate, which judges frames against the last one
+            // encoded, not the last one detection saw.
+            next_detection = now + detection_interval;
+            {
+                std::lock_guard<std::mutex> lock(detection_mutex);
+                detection_input.image = frame.image;
+                if (frame.image.empty() && frame.jpeg)
+                    detection_input.jpeg.assign(frame.jpeg, frame.jpeg + frame.jpeg_size);
+                else
+                    detection_input.jpeg.clear();
+                detection_input.captured = frame.captured;
+                detection_input.camera_seq = frame.sequence;
+                detection_input.fresh = true;
+            }
+            detection_cv.notify_one();
+        }
+        if (targets.empty()) {
+            releaseFrame();
+            continue;
+        }
+
+        // Static table: skip the encode unless something moved, a keep-alive
+        // is due, or a freshly opened profile has no frame yet
+        if (motion_gate) {
+            for (const EncodeTarget& t : targets) {
+                if (!t.hub->latest())
+                    gate.force();
+            }
+            if (!gate.shouldSend(frame.image, frame.jpeg, frame.jpeg_size, now)) {
+                releaseFrame();
+                continue;
+            }
+        }
+        ++seq;
+
+        if (mjpeg_passthrough && frame.jpeg) {
+            // The default profile gets the JPEG as the camera produced it, the client crops
+            auto it = std::find_if(targets.begin(), targets.end(), [](const EncodeTarget& t) {
+                return t.profile == StreamProfile();
+            });
+            if (it != targets.end()) {
+                auto encoded = encoder.acquireFrame();
+                encoded->seq = seq;
+                encoded->captured = frame.captured;
+                encoded->camera_seq = frame.sequence;
+                const int crop_width = static_cast<int>(raw_width * stream_crop);
+                encoded->crop_x = (raw_width - crop_width) / 2;
+                encoded->crop_w = crop_width;
+                encoded->crop_h = raw_height;
+                encoded->jpg.assign(frame.jpeg, frame.jpeg + frame.jpeg_size);
+                if (metrics.tracing())
+                    metrics.record(TraceStage::Encode, std::chrono::steady_clock::now() - frame.captured);
+                it->hub->publish(std::move(encoded));
+                metrics.count(TraceCounter::FramesEncoded);
+                targets.erase(it);
+            }
+        }
+
+        // Decode, crop and re‑encode on the worker pool, once per profile
+        // A frame the gate passed but the busy pool dropped is already the gate's
+        // reference, so force the next one or the change never reaches viewers
+        if (!targets.empty() &&
+            !encoder.submit(seq, frame.captured, frame.sequence, frame.image, frame.jpeg, frame.jpeg_size, targets) &&
+            motion_gate)
+            gate.force();
+        releaseFrame();
+    }
+    encoder.stop();
+}
+
+static void broadcastDetections(const std::string& msg) {
+    std::lock_guard<std::mutex> lock(detection_conns_mutex);
+    for (mg_connection* conn : detection_conns)
+        mg_websocket_write(conn, MG_WEBSOCKET_OPCODE_TEXT, msg.c_str(), msg.size());
+}
+
+// Current pixel -> world homography (row major), for clients that draw in world space
+static json calibrationJson() {
+    std::array<double, 9> H;
+    bool calibrated = calibration.homography(H);
+    return {
+        {"type", "calibration"},
+        {"calibrated", calibrated},
+        {"fresh", calibration.isFresh()},
+        {"H", calibrated ? json(H) : json(nullptr)},
+    };
+}
+
+// Runs the cylinder detector on the newest frame and publishes the result
+static void detectionLoop() {
+    using namespace Constants;
+    ObjectDetector detector;
+    if (!detector.loadBackground(background_path))
+        std::cerr << "[warn] Detection waits for a background, send \"background\" on /detections.\n";
+
+    DetectionInput input;
+    cv::Mat gray;
+    std::vector<Detection> detections;
+    auto next_calibration = std::chrono::steady_clock::now();
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(detection_mutex);
+            detection_cv.wait(lock, [] { return detection_input.fresh || !keep_running.load(); });
+            if (!keep_running.load())
+                return;
+            std::swap(input, detection_input);
+            detection_input.fresh = false;
+        }
+
+        // The detector only needs luma, which libjpeg can give us without colour conversion
+        if (!input.image.empty())
+            cv::cvtColor(input.image, gray, cv::COLOR_BGR2GRAY);
+        else if (!input.jpeg.empty())
+            gray = cv::imdecode(input.jpeg, cv::IMREAD_GRAYSCALE);
+        else
+            gray.release();     // Nothing to look at, don't rerun on the last frame
+        input.image.release();
+        if (gray.empty())
+            continue;
+
+        // Same centre crop the PC app saw on /stream
+        const int crop_width = static_cast<int>(gray.cols * stream_crop);
+        cv::Mat cropped = gray(cv::Rect((gray.cols - crop_width) / 2, 0, crop_width, gray.rows));
+
+        if (update_background.exchange(false)) {
+            detector.setBackground(cropped);
+            cv::imwrite(background_path, cropped);
+            std::cout << "Detection background updated.\n";
+        }
+
+        // Marker detection is the expensive part of calibration, run it sparingly
+        auto now = std::chrono::steady_clock::now();
+        if (now >= next_calibration) {
+            next_calibration = now + calibration_interval;
+            if (calibration.update(cropped))
+                broadcastDetections(calibrationJson().dump());
+        }
+
+        if (!detector.detect(cropped, detections))
+            continue;
+
+        now = std::chrono::steady_clock::now();
+        json objects = json::array();
+        for (const Detection& d : detections) {
+            json obj = {
+                {"x", d.x},
+                {"y", d.y},
+                {"bbox", {d.bbox.x, d.bbox.y, d.bbox.width, d.bbox.height}},
+                {"color", colorName(d.color)},
+            };
+            double wx, wy;
+            if (calibration.pixelToWorld(d.x, d.y, wx, wy)) {
+                // The marker square around the robot base is not part of the table
+                if (std::abs(wx) <= robot_zone_half && std::abs(wy) <= robot_zone_half)
+                    continue;
+                obj["world_x"] = wx;
+                obj["world_y"] = wy;
+                obj["reachable"] = workspaceMap().reachable(wx, wy);
+            }
+            objects.push_back(obj);
+        }
+        json msg = {
+            {"type", "detections"},
+            {"calibrated", calibration.isFresh()},
+            {"frame_seq", input.camera_seq},
+            {"captured_us", std::chrono::duration_cast<std::chrono::microseconds>(
+                input.captured.time_since_epoch()).count()},
+            {"age_ms", std::chrono::duration<double, std::milli>(now - input.captured).count()},
+            {"objects", objects},
+        };
+        broadcastDetections(msg.dump());
+    }
+}
+
+static int detectionsConnect(const mg_connection* conn, void*) {
+    std::lock_guard<std::mutex> lock(detection_conns_mutex);
+    detection_conns.insert(const_cast<mg_connection*>(conn));
+    detection_clients.store(static_cast<int>(detection_conns.size()));
+    return 0;
+}
+
+static void detectionsClose(const mg_connection* conn, void*) {
+    std::lock_guard<std::mutex> lock(detection_conns_mutex);
+    detection_conns.erase(const_cast<mg_connection*>(conn));
+    detection_clients.store(static_cast<int>(detection_conns.size()));
+}
+
+// New clients get the current homography straight away
+static void detectionsReady(mg_connection *conn, void*) {
+    std::string msg = calibrationJson().dump();
+    mg_websocket_write(conn, MG_WEBSOCKET_OPCODE_TEXT, msg.c_str(), msg.size());
+}
+
+static int calibrationHandler(struct mg_connection *conn, void * /*cbdata*/) {
+    std::string body = calibrationJson().dump();
+    mg_printf(conn,
+              "HTTP/1.1 200 OK\r\n"
+              "Content-Type: application/json\r\n"
+              "Content-Length: %zu\r\n"
+              "Connection: close\r\n\r\n",
+              body.size());
+    mg_write(conn, body.data(), body.size());
+    return 200;
+}
+
+// "background" makes the next processed frame the new reference background
+static int detectionsMessage(mg_connection *, int, char *data, size_t len, void*) {
+    if (std::string(data, len) == "background")
+        update_background.store(true);
+    return 1; // keep the connection open
+}
+
+// Find or create the channel for a profile; caller holds profiles_mutex
+static std::shared_ptr<ProfileChannel> findProfile(const StreamProfile& profile) {
+    auto it = profiles.find(profile);
+    if (it == profiles.end()) {
+        if (profiles.size() >= static_cast<size_t>(Constants::max_stream_profiles))
+            return nullptr;
+        auto channel = std::make_shared<ProfileChannel>();
+        channel->profile = profile;
+        it = profiles.emplace(profile, channel).first;
+    }
+    return it->second;
+}
+
+// Register a stream client for a profile
+static std::shared_ptr<ProfileChannel> joinProfile(const StreamProfile& profile) {
+    std::lock_guard<std::mutex> lock(profiles_mutex);
+    auto channel = findProfile(profile);
+    if (channel)
+        channel->clients++;
+    return channel;
+}
+
+// Keep a profile encoding for a while after a snapshot request
+static std::shared_ptr<ProfileChannel> leaseProfile(const StreamProfile& profile) {
+    std::lock_guard<std::mutex> lock(profiles_mutex);
+    auto channel = findProfile(profile);
+    if (channel)
+        channel->lease_until = std::chrono::steady_clock::now() + Constants::snapshot_lease;
+    return channel;
+}
+
+// Drop a client; the last one out stops the profile from being encoded
+static void leaveProfile(const std::shared_ptr<ProfileChannel>& channel) {
+    std::lock_guard<std::mutex> lock(profiles_mutex);
+    --channel->clients;
+    if (channel->idle(std::chrono::steady_clock::now()))
+        profiles.erase(channel->profile);
+}
+
+// Read a numeric query parameter, e.g. fps in /stream?fps=10
+static double queryParam(const mg_connection *conn, const char *name, double fallback) {
+    const mg_request_info *info = mg_get_request_info(conn);
+    if (info->query_string == nullptr)
+        return fallback;
+    char value[32];
+    if (mg_get_var(info->query_string, std::strlen(info->query_string), name, value, sizeof(value)) <= 0)
+        return fallback;
+    char *end = nullptr;
+    double parsed = std::strtod(value, &end);
+    return end != value && std::isfinite(parsed) ? parsed : fallback;
+}
+
+// Stream profile from the query, e.g. /stream?w=640&q=70&crop=0.7. Values are
+// rounded so that near-identical requests share one encoded stream.
+static StreamProfile parseProfile(const mg_connection *conn) {
+    using namespace Constants;
+    StreamProfile p;
+    // Clamped while still double, casting an out of range value is undefined
+    int width = static_cast<int>(std::clamp(queryParam(conn, "w", 0), 0.0, static_cast<double>(frame_width)));
+    p.width = width <= 0 ? 0 : std::clamp(width / 16 * 16, 160, frame_width);
+    int quality = static_cast<int>(std::clamp(queryParam(conn, "q", jpeg_quality), 0.0, 100.0));
+    p.quality = std::clamp((quality + 2) / 5 * 5, 10, 95);
+    double crop = queryParam(conn, "crop", stream_crop);
+    p.crop = std::clamp(std::round(crop * 20.0) / 20.0, 0.1, 1.0);
+    return p;
+}
+
 static int streamHandler(struct mg_connection *conn, void * /*cbdata*/) {
+    using clock = std::chrono::steady_clock;
+
+    auto channel = joinProfile(parseProfile(conn));
+    if (!channel) {
+        mg_send_http_error(conn, 503, "Too many stream profiles");
+        return 503;
+    }
+
     // 1.  HTTP headers for MJPEG
     mg_printf(conn,
         "HTTP/1.0 200 OK\r\n"
         "Cache-Control: no-cache\r\n"
         "Pragma: no-cache\r\n"
         "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n\r\n");
-        
-    std::vector<uchar> jpg;
-    cv::Mat frame;
 
-    while (keep_running.load())
+    auto stats = std::make_shared<StreamClientStats>();
+    stats->remote = mg_get_request_info(conn)->remote_addr;
+    stats->profile = channel->profile;
+    stats->target_fps = std::clamp(queryParam(conn, "fps", Constants::frame_fps), 1.0, 60.0);
     {
-        if (!cam.read(frame))  // grab frame
-            continue;
+        std::lock_guard<std::mutex> lock(stream_stats_mutex);
+        stream_stats.push_back(stats);
+    }
 
-        const int original_width = frame.cols;
-        const int crop_width = static_cast<int>(original_width * 0.70);
-        const int x_offset = (original_width - crop_width) / 2;
+    const auto period = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(1.0 / stats->target_fps));
+    auto next_send = clock::now();
+    uint64_t last_seq = 0;
 
-        cv::Rect roi(x_offset, 0, crop_width, frame.rows);
-        cv::Mat cropped = frame(roi);
+    while (keep_running.load())
+    {
+        // 2. Pace to the client's rate; frames published meanwhile are stale
+        std::this_thread::sleep_until(next_send);
 
-        // 2. Re‑encode to JPEG (quality=70 → good size/latency compromise)
-        jpg.clear();
-        cv::imencode(".jpg", cropped, jpg, {cv::IMWRITE_JPEG_QUALITY, 90});
+        // 3. Always send the newest frame, skipping whatever this client missed
+        //    while it was sleeping or blocked in mg_write on a full socket
+        FramePtr frame = channel->hub->waitNewer(last_seq, std::chrono::seconds(1));
+        if (!frame)
+            continue;
+        if (last_seq != 0 && frame->seq > last_seq + 1)
+            stats->dropped.fetch_add(frame->seq - last_seq - 1, std::memory_order_relaxed);
+        last_seq = frame->seq;
+        next_send = std::max(next_send + period, clock::now());
 
-        // 3. Send multipart boundary + JPEG chunk
+        // 4. Send multipart boundary + JPEG chunk
         mg_printf(conn,
                   "--frame\r\n"
                   "Content-Type: image/jpeg\r\n"
-                  "Content-Length: %zu\r\n\r\n",
-                  jpg.size());
-        mg_write(conn, jpg.data(), jpg.size());
+                  "Content-Length: %zu\r\n",
+                  frame->jpg.size());
+        if (frame->crop_w > 0) {
+            mg_printf(conn, "X-Crop: %d,%d,%d,%d\r\n",
+                      frame->crop_x, frame->crop_y, frame->crop_w, frame->crop_h);
+        }
+        const double age_ms = std::chrono::duration<double, std::milli>(
+            clock::now() - frame->captured).count();
+        mg_printf(conn, "X-Frame-Seq: %u\r\nX-Frame-Age-Ms: %.1f\r\n\r\n", frame->camera_seq, age_ms);
+        if (mg_write(conn, frame->jpg.data(), frame->jpg.size()) <= 0)
+            break;  // Client went away
         mg_printf(conn, "\r\n");
+        stats->sent.fetch_add(1, std::memory_order_relaxed);
+        metrics.count(TraceCounter::FramesSent);
+        if (metrics.tracing())
+            metrics.record(TraceStage::StreamSend, clock::now() - frame->captured);
+    }
 
-        // 25–30 fps → sleep ≈33 ms
-        std::this_thread::sleep_for(std::chrono::milliseconds(33));
+    leaveProfile(channel);
+    {
+        std::lock_guard<std::mutex> lock(stream_stats_mutex);
+        stream_stats.erase(std::remove(stream_stats.begin(), stream_stats.end(), stats), stream_stats.end());
     }
     return 0;  // close connection
 }
 
+// Reachability grid as a grayscale PNG, one pixel per cell with +y up:
+// 255 reachable, 128 on the edge, 0 unreachable. Never changes, so it is
+// encoded once.
+static int workspaceHandler(struct mg_connection *conn, void * /*cbdata*/) {
+    static const std::vector<uchar> png = [] {
+        const WorkspaceMap& map = workspaceMap();
+        cv::Mat image(map.rows(), map.cols(), CV_8UC1);
+        for (int r = 0; r < map.rows(); ++r) {
+            uchar* row = image.ptr<uchar>(map.rows() - 1 - r);
+            for (int c = 0; c < map.cols(); ++c) {
+                uint8_t flags = map.cells()[r * map.cols() + c];
+                row[c] = (flags & WorkspaceMap::Boundary) ? 128 : (flags == WorkspaceMap::Reachable ? 255 : 0);
+            }
+        }
+        std::vector<uchar> out;
+        cv::imencode(".png", image, out);
+        return out;
+    }();
+
+    const WorkspaceMap& map = workspaceMap();
+    mg_printf(conn,
+              "HTTP/1.1 200 OK\r\n"
+              "Content-Type: image/png\r\n"
+              "Content-Length: %zu\r\n"
+              "Cache-Control: max-age=3600\r\n"
+              "X-Workspace-Origin: %.3f,%.3f\r\n"
+              "X-Workspace-Cell: %.3f\r\n"
+              "Connection: close\r\n\r\n",
+              png.size(), map.originX(), map.originY(), map.cellSize());
+    mg_write(conn, png.data(), png.size());
+    return 200;
+}
+
+// Latest frame of a profile as a single JPEG, e.g. /snapshot.jpg?w=640.
+// The ETag is the frame sequence, so pollers get 304 until a new frame exists.
+// Sequences restart with the process, so it also carries a per-boot nonce.
+static int snapshotHandler(struct mg_connection *conn, void * /*cbdata*/) {
+    static const uint32_t boot_nonce = std::random_device{}();
+    auto channel = leaseProfile(parseProfile(conn));
+    if (!channel) {
+        mg_send_http_error(conn, 503, "Too many stream profiles");
+        return 503;
+    }
+
+    // A profile that was idle has nothing cached yet, wait for its first frame
+    FramePtr frame = channel->hub->latest();
+    if (!frame)
+        frame = channel->hub->waitNewer(0, std::chrono::seconds(1));
+    if (!frame) {
+        mg_send_http_error(conn, 503, "No frame available");
+        return 503;
+    }
+
+    char etag[48];
+    std::snprintf(etag, sizeof(etag), "\"%08x-%llu\"", boot_nonce, static_cast<unsigned long long>(frame->seq));
+    const char *if_none_match = mg_get_header(conn, "If-None-Match");
+    if (if_none_match != nullptr && std::strcmp(if_none_match, etag) == 0) {
+        mg_printf(conn,
+                  "HTTP/1.1 304 Not Modified\r\n"
+                  "ETag: %s\r\n"
+                  "Cache-Control: no-cache\r\n"
+                  "Content-Length: 0\r\n\r\n",
+                  etag);
+        return 304;
+    }
+
+    const double age_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - frame->captured).count();
+    mg_printf(conn,
+              "HTTP/1.1 200 OK\r\n"
+              "Content-Type: image/jpeg\r\n"
+              "Content-Length: %zu\r\n"
+              "ETag: %s\r\n"
+              "Cache-Control: no-cache\r\n"
+              "X-Frame-Seq: %u\r\n"
+              "X-Frame-Age-Ms: %.1f\r\n",
+              frame->jpg.size(), etag, frame->camera_seq, age_ms);
+    if (frame->crop_w > 0) {
+        mg_printf(conn, "X-Crop: %d,%d,%d,%d\r\n",
+                  frame->crop_x, frame->crop_y, frame->crop_w, frame->crop_h);
+    }
+    mg_printf(conn, "\r\n");
+    mg_write(conn, frame->jpg.data(), frame->jpg.size());
+    return 200;
+}
+
+// Per-client counters for every open /stream connection, as JSON
+static int streamStatsHandler(struct mg_connection *conn, void * /*cbdata*/) {
+    json clients = json::array();
+    {
+        std::lock_guard<std::mutex> lock(stream_stats_mutex);
+        for (const auto& c : stream_stats) {
+            clients.push_back({
+                {"remote", c->remote},
+                {"width", c->profile.width},
+                {"quality", c->profile.quality},
+                {"crop", c->profile.crop},
+                {"target_fps", c->target_fps},
+                {"sent", c->sent.load()},
+                {"dropped", c->dropped.load()},
+            });
+        }
+    }
+    std::string body = clients.dump();
+    mg_printf(conn,
+              "HTTP/1.1 200 OK\r\n"
+              "Content-Type: application/json\r\n"
+              "Content-Length: %zu\r\n"
+              "Connection: close\r\n\r\n",
+              body.size());
+    mg_write(conn, body.data(), body.size());
+    return 200;
+}
+
+static json histogram_json(const LatencyHistogram& histogram) {
+    LatencyHistogram::Summary s = histogram.summary();
+    return {
+        {"count", s.count},
+        {"min", s.min_us},
+        {"mean", s.mean_us},
+        {"p50", s.p50_us},
+        {"p90", s.p90_us},
+        {"p99", s.p99_us},
+        {"p999", s.p999_us},
+        {"max", s.max_us},
+    };
+}
+
+// Motor thread control tick timing in microseconds, /timing?reset=1 starts over
+static int timingHandler(struct mg_connection *conn, void * /*cbdata*/) {
+    json timing = {
+        {"realtime", control_timing.realtime.load(std::memory_order_relaxed)},
+        {"target_us", Constants::control_loop_ms * 1000},
+        {"period_us", histogram_json(control_timing.period)},
+        {"jitter_us", histogram_json(control_timing.jitter)},
+        {"work_us", histogram_json(control_timing.work)},
+        {"overruns", control_timing.overruns.load(std::memory_order_relaxed)},
+    };
+    if (queryParam(conn, "reset", 0) != 0)
+        control_timing.reset();
+    std::string body = timing.dump();
+    mg_printf(conn,
+              "HTTP/1.1 200 OK\r\n"
+              "Content-Type: application/json\r\n"
+              "Content-Length: %zu\r\n"
+              "Connection: close\r\n\r\n",
+              body.size());
+    mg_write(conn, body.data(), body.size());
+    return 200;
+}
+
+// Prometheus text exposition of the stage latencies and counters. The first
+// scrape turns the stage timestamps on, so its histograms are still empty.
+static int metricsHandler(struct mg_connection *conn, void * /*cbdata*/) {
+    using clock = std::chrono::steady_clock;
+    metrics.scraped();
+
+    // Camera rate since the previous scrape
+    static std::mutex fps_mutex;
+    static uint64_t last_frames = 0;
+    static clock::time_point last_scrape;
+    double fps = 0.0;
+    {
+        std::lock_guard<std::mutex> lock(fps_mutex);
+        const auto now = clock::now();
+        const uint64_t frames = metrics.value(TraceCounter::FramesCaptured);
+        const double elapsed = std::chrono::duration<double>(now - last_scrape).count();
+        if (last_scrape != clock::time_point() && elapsed > 0)
+            fps = static_cast<double>(frames - last_frames) / elapsed;
+        last_frames = frames;
+        last_scrape = now;
+    }
+
+    std::string body;
+    body.reserve(8192);
+    metrics.render(body);
+    const JobStats st = jobHandler.stats();
+    char gauges[1024];
+    std::snprintf(gauges, sizeof(gauges),
+                  "# TYPE raspberry_camera_fps gauge\nraspberry_camera_fps %.2f\n"
+                  "# TYPE raspberry_job_queue_depth gauge\nraspberry_job_queue_depth %zu\n"
+                  "# TYPE raspberry_jobs_coalesced_total counter\nraspberry_jobs_coalesced_total %llu\n"
+                  "# TYPE raspberry_jobs_dropped_total counter\nraspberry_jobs_dropped_total %llu\n"
+                  "# TYPE raspberry_jobs_dropped_ordered_total counter\nraspberry_jobs_dropped_ordered_total %llu\n"
+                  "# TYPE raspberry_log_dropped_total counter\nraspberry_log_dropped_total %llu\n",
+                  fps, st.depth, static_cast<unsigned long long>(st.coalesced),
+                  static_cast<unsigned long long>(st.dropped),
+                  static_cast<unsigned long long>(st.dropped_ordered),
+                  static_cast<unsigned long long>(logger().dropped()));
+    body += gauges;
+
+    mg_printf(conn,
+              "HTTP/1.1 200 OK\r\n"
+              "Content-Type: text/plain; version=0.0.4\r\n"
+              "Content-Length: %zu\r\n"
+              "Connection: close\r\n\r\n",
+              body.size());
+    mg_write(conn, body.data(), body.size());
+    return 200;
+}
+
 void start_mjpeg_server(bool stream) {
+    using namespace Constants;
     if (stream) {
-        // Open camera
-        cam.open("/dev/video0", cv::CAP_V4L2);
-        if(!cam.isOpened()) { throw std::runtime_error("Camera open failed"); }
-        cam.set(cv::CAP_PROP_FRAME_WIDTH,  1280);
-        cam.set(cv::CAP_PROP_FRAME_HEIGHT, 720);
-        cam.set(cv::CAP_PROP_FPS, 30);
-        cam.set(cv::CAP_PROP_AUTO_EXPOSURE, 0.25); // Manual
-        cam.set(cv::CAP_PROP_EXPOSURE, 200);       // Value depends on sensor
-        cam.set(cv::CAP_PROP_WHITE_BALANCE_BLUE_U, 4500);
+        // Open camera, straight through V4L2 when possible
+        const uint32_t fourcc = mjpeg_passthrough || v4l2_prefer_mjpeg ? V4L2_PIX_FMT_MJPEG : V4L2_PIX_FMT_YUYV;
+        if (use_v4l2_capture &&
+            v4l2.open("/dev/video0", frame_width, frame_height, frame_fps, fourcc, v4l2_queue_depth)) {
+            if (mjpeg_passthrough && v4l2.pixelFormat() != V4L2_PIX_FMT_MJPEG) {
+                throw std::runtime_error("Camera does not support MJPG passthrough");
+            }
+            v4l2.setControl(V4L2_CID_EXPOSURE_AUTO, V4L2_EXPOSURE_MANUAL);
+            v4l2.setControl(V4L2_CID_EXPOSURE_ABSOLUTE, 200);          // Value depends on sensor
+            v4l2.setControl(V4L2_CID_AUTO_WHITE_BALANCE, 0);
+            v4l2.setControl(V4L2_CID_WHITE_BALANCE_TEMPERATURE, 4500);
+            std::cout << "Camera opened through V4L2 mmap (" << v4l2.width() << "x" << v4l2.height() << ")\n";
+        } else {
+            if (use_v4l2_capture)
+                std::cerr << "[warn] V4L2 capture unavailable, falling back to OpenCV\n";
+            cam.open("/dev/video0", cv::CAP_V4L2);
+            if(!cam.isOpened()) { throw std::runtime_error("Camera open failed"); }
+            if (mjpeg_passthrough) {
+                // Ask for MJPG and hand back the compressed buffer instead of decoding it
+                cam.set(cv::CAP_PROP_FOURCC, cv::VideoWriter::fourcc('M','J','P','G'));
+                cam.set(cv::CAP_PROP_CONVERT_RGB, 0);
+                if (static_cast<int>(cam.get(cv::CAP_PROP_FOURCC)) != cv::VideoWriter::fourcc('M','J','P','G')) {
+                    throw std::runtime_error("Camera does not support MJPG passthrough");
+                }
+            }
+            cam.set(cv::CAP_PROP_FRAME_WIDTH,  frame_width);
+            cam.set(cv::CAP_PROP_FRAME_HEIGHT, frame_height);
+            cam.set(cv::CAP_PROP_FPS, frame_fps);
+            cam.set(cv::CAP_PROP_AUTO_EXPOSURE, 0.25); // Manual
+            cam.set(cv::CAP_PROP_EXPOSURE, 200);       // Value depends on sensor
+            cam.set(cv::CAP_PROP_WHITE_BALANCE_BLUE_U, 4500);
+        }
+
+        capture_thread = std::thread(captureLoop);
+        if (detection_enabled)
+            detection_thread = std::thread(detectionLoop);
     }
     // CivetWeb config
     const char *options[] = {
@@ -133,9 +1007,32 @@ void start_mjpeg_server(bool stream) {
     // Register the /stream endpoint
     if (stream) {
         mg_set_request_handler(ctx, "/stream", streamHandler, nullptr);
+        mg_set_request_handler(ctx, "/stream/stats", streamStatsHandler, nullptr);
+        mg_set_request_handler(ctx, "/snapshot.jpg", snapshotHandler, nullptr);
         std::puts("MJPEG stream running on http://raspberrypi.local:8080/stream");
+        if (detection_enabled) {
+            mg_set_websocket_handler(ctx, "/detections", detectionsConnect, detectionsReady, detectionsMessage, detectionsClose, nullptr);
+            mg_set_request_handler(ctx, "/calibration", calibrationHandler, nullptr);
+        }
     }
     mg_set_websocket_handler(ctx, "/ws", wsConnect, nullptr, wsMessage, wsClose, nullptr);
+    mg_set_request_handler(ctx, "/jobs", jobsHandler, nullptr);
+    mg_set_request_handler(ctx, "/timing", timingHandler, nullptr);
+    mg_set_request_handler(ctx, "/metrics", metricsHandler, nullptr);
+    mg_set_request_handler(ctx, "/workspace.png", workspaceHandler, nullptr);
 }
 
-void stop_mjpeg_server() { keep_running = false; }
+void stop_mjpeg_server() {
+    keep_running = false;
+    {
+        std::lock_guard<std::mutex> lock(profiles_mutex);
+        for (auto& [profile, channel] : profiles)
+            channel->hub->close();
+    }
+    if (capture_thread.joinable())
+        capture_thread.join();
+    detection_cv.notify_all();
+    if (detection_thread.joinable())
+        detection_thread.join();
+    v4l2.close();
+}
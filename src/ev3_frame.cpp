@@ -0,0 +1,120 @@
+#include "ev3_frame.hpp"
+
+#include <cmath>
+#include <cstdio>
+
+uint16_t crc16_ccitt(const uint8_t* data, size_t size) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= static_cast<uint16_t>(data[i]) << 8;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+    }
+    return crc;
+}
+
+static void putU16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back(static_cast<uint8_t>(value));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+static void putI32(std::vector<uint8_t>& out, int32_t value) {
+    uint32_t u = static_cast<uint32_t>(value);
+    for (int shift = 0; shift < 32; shift += 8)
+        out.push_back(static_cast<uint8_t>(u >> shift));
+}
+
+static void putStep(std::vector<uint8_t>& out, const Ev3Step& step) {
+    switch (step.op) {
+        case Ev3Op::Motor:
+        case Ev3Op::Setpoint:
+        case Ev3Op::Velocity:
+            putI32(out, static_cast<int32_t>(std::lround(step.a * 1000.0)));
+            putI32(out, static_cast<int32_t>(std::lround(step.b * 1000.0)));
+            break;
+        case Ev3Op::Grabber:
+            out.push_back(step.grab ? 1 : 0);
+            break;
+        default:
+            break;
+    }
+}
+
+static void finishFrame(std::vector<uint8_t>& out, size_t start) {
+    size_t length = out.size() - start - ev3_frame_header;
+    out[start + 8] = static_cast<uint8_t>(length);
+    out[start + 9] = static_cast<uint8_t>(length >> 8);
+    putU16(out, crc16_ccitt(out.data() + start, out.size() - start));
+}
+
+static size_t beginFrame(std::vector<uint8_t>& out, Ev3Op op, uint8_t steps, uint32_t seq) {
+    size_t start = out.size();
+    out.push_back(ev3_frame_magic);
+    out.push_back(ev3_frame_version);
+    out.push_back(static_cast<uint8_t>(op));
+    out.push_back(steps);
+    putI32(out, static_cast<int32_t>(seq));
+    putU16(out, 0);     // Length, filled in by finishFrame
+    return start;
+}
+
+void encodeEv3Frame(uint32_t seq, const std::vector<Ev3Step>& steps, std::vector<uint8_t>& out) {
+    if (steps.size() == 1) {
+        size_t start = beginFrame(out, steps[0].op, 1, seq);
+        putStep(out, steps[0]);
+        finishFrame(out, start);
+        return;
+    }
+    size_t start = beginFrame(out, Ev3Op::Plan, static_cast<uint8_t>(steps.size()), seq);
+    for (const auto& step : steps) {
+        out.push_back(static_cast<uint8_t>(step.op));
+        putStep(out, step);
+    }
+    finishFrame(out, start);
+}
+
+void encodeEv3Control(Ev3Op op, std::vector<uint8_t>& out) {
+    size_t start = beginFrame(out, op, 0, 0);
+    finishFrame(out, start);
+}
+
+static void appendText(std::string& out, const Ev3Step& step) {
+    char buffer[50];
+    switch (step.op) {
+        case Ev3Op::Motor:
+            std::snprintf(buffer, sizeof(buffer), "MOTOR %.2f %.2f", step.a, step.b); // round to 2 decimal places
+            out += buffer;
+            break;
+        case Ev3Op::Setpoint:
+            std::snprintf(buffer, sizeof(buffer), "SP %.2f %.2f", step.a, step.b);
+            out += buffer;
+            break;
+        case Ev3Op::Velocity:
+            std::snprintf(buffer, sizeof(buffer), "VEL %.2f %.2f", step.a, step.b);
+            out += buffer;
+            break;
+        case Ev3Op::Grabber:
+            out += step.grab ? "GRABBER on" : "GRABBER off";
+            break;
+        case Ev3Op::Stop:
+            out += "STOP";
+            break;
+        case Ev3Op::Shutdown:
+            out += "SHUTDOWN";
+            break;
+        case Ev3Op::Plan:
+            break;
+    }
+}
+
+std::string formatEv3Text(const std::vector<Ev3Step>& steps) {
+    std::string text;
+    if (steps.size() > 1)
+        text = "PLAN ";
+    for (size_t i = 0; i < steps.size(); ++i) {
+        if (i > 0)
+            text += ";";
+        appendText(text, steps[i]);
+    }
+    return text;
+}
@@ -0,0 +1,103 @@
+#include "event_loop.hpp"
+#include "logger.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <stdexcept>
+
+EventLoop::EventLoop() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || stop_fd < 0) { throw std::runtime_error("EventLoop setup failed"); }
+    add(stop_fd, EPOLLIN, [this](uint32_t) { stopping = true; });
+}
+
+EventLoop::~EventLoop() {
+    // Timers are owned by the loop, other fds by whoever added them
+    for (int fd : timers)
+        close(fd);
+    close(stop_fd);
+    close(epoll_fd);
+}
+
+bool EventLoop::add(int fd, uint32_t events, Handler handler) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        logError("epoll_ctl add failed for fd {}", fd);
+        return false;
+    }
+    handlers[fd] = std::make_shared<Handler>(std::move(handler));
+    return true;
+}
+
+bool EventLoop::modify(int fd, uint32_t events) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void EventLoop::remove(int fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    handlers.erase(fd);
+}
+
+int EventLoop::addTimer(std::chrono::nanoseconds period, std::function<void(uint64_t)> tick) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) return -1;
+
+    itimerspec spec{};
+    spec.it_interval.tv_sec = period.count() / 1000000000;
+    spec.it_interval.tv_nsec = period.count() % 1000000000;
+    spec.it_value = spec.it_interval;
+    if (timerfd_settime(fd, 0, &spec, nullptr) < 0 ||
+        !add(fd, EPOLLIN, [fd, tick = std::move(tick)](uint32_t) {
+            uint64_t expirations = 0;
+            if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+                tick(expirations);
+        })) {
+        close(fd);
+        return -1;
+    }
+    timers.insert(fd);
+    return fd;
+}
+
+void EventLoop::cancelTimer(int id) {
+    if (timers.erase(id) == 0) return;
+    remove(id);
+    close(id);
+}
+
+void EventLoop::run() {
+    epoll_event events[16];
+    while (!stopping) {
+        int n = epoll_wait(epoll_fd, events, 16, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            logError("epoll_wait failed.");
+            return;
+        }
+        for (int i = 0; i < n && !stopping; ++i) {
+            // A handler may remove any fd, itself included, so look it up
+            // every time and keep it alive while it runs
+            auto it = handlers.find(events[i].data.fd);
+            if (it != handlers.end()) {
+                std::shared_ptr<Handler> handler = it->second;
+                (*handler)(events[i].events);
+            }
+        }
+    }
+}
+
+void EventLoop::stop() {
+    stopping = true;
+    uint64_t one = 1;
+    ssize_t n = write(stop_fd, &one, sizeof(one));
+    (void)n;
+}
@@ -0,0 +1,68 @@
+#include "frame_hub.hpp"
+
+void FrameHub::publish(FramePtr frame) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        current = std::move(frame);
+    }
+    cv.notify_all();
+}
+
+FramePtr FrameHub::latest() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return current;
+}
+
+FramePtr FrameHub::waitNewer(uint64_t after_seq, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mtx);
+    bool ready = cv.wait_for(lock, timeout, [&] {
+        return closed || (current && current->seq > after_seq);
+    });
+    if (!ready || closed)
+        return nullptr;
+    return current;
+}
+
+void FrameHub::close() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+    }
+    cv.notify_all();
+}
+
+FramePool::FramePool(size_t jpg_capacity) : state(std::make_shared<State>()) {
+    state->jpg_capacity = jpg_capacity;
+}
+
+FramePool::State::~State() {
+    for (EncodedFrame* f : free)
+        delete f;
+}
+
+std::shared_ptr<EncodedFrame> FramePool::acquire() {
+    EncodedFrame* f = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(state->mtx);
+        if (!state->free.empty()) {
+            f = state->free.back();
+            state->free.pop_back();
+        }
+    }
+    if (f == nullptr) {
+        f = new EncodedFrame();
+        f->jpg.reserve(state->jpg_capacity);
+    }
+
+    // Reset everything but the buffer capacity
+    f->seq = 0;
+    f->camera_seq = 0;
+    f->jpg.clear();
+    f->crop_x = f->crop_y = f->crop_w = f->crop_h = 0;
+
+    std::shared_ptr<State> owner = state;
+    return std::shared_ptr<EncodedFrame>(f, [owner](EncodedFrame* done) {
+        std::lock_guard<std::mutex> lock(owner->mtx);
+        owner->free.push_back(done);
+    });
+}
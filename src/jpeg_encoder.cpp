@@ -0,0 +1,148 @@
+#include "jpeg_encoder.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+
+JpegEncoderPool::JpegEncoderPool(int threads) : frames(512 * 1024) {
+    threads = std::max(1, threads);
+    // One slot per worker plus one being filled, so the camera never waits
+    slots.resize(threads + 1);
+    for (int i = static_cast<int>(slots.size()) - 1; i >= 0; --i)
+        free_slots.push_back(i);
+    for (int i = 0; i < threads; ++i)
+        workers.emplace_back(&JpegEncoderPool::worker, this);
+}
+
+JpegEncoderPool::~JpegEncoderPool() {
+    stop();
+}
+
+void JpegEncoderPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (std::thread& t : workers) {
+        if (t.joinable())
+            t.join();
+    }
+    workers.clear();
+}
+
+bool JpegEncoderPool::submit(uint64_t seq, std::chrono::steady_clock::time_point captured, uint32_t camera_seq,
+                             const cv::Mat& image, const unsigned char* jpeg, size_t jpeg_size,
+                             const std::vector<EncodeTarget>& targets) {
+    if (targets.empty())
+        return false;
+
+    int index;
+    uint64_t ticket;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (stopping)
+            return false;
+        if (free_slots.empty()) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;   // All workers busy, the next frame will be fresher anyway
+        }
+        index = free_slots.back();
+        free_slots.pop_back();
+        ticket = next_ticket++;
+    }
+
+    // The slot is ours until a worker picks it up
+    Slot& slot = slots[index];
+    slot.ticket = ticket;
+    slot.seq = seq;
+    slot.captured = captured;
+    slot.camera_seq = camera_seq;
+    slot.image = image;
+    if (image.empty() && jpeg)
+        slot.jpeg.assign(jpeg, jpeg + jpeg_size);
+    else
+        slot.jpeg.clear();
+    slot.targets = targets;
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        work.push_back(index);
+    }
+    cv.notify_one();
+    return true;
+}
+
+void JpegEncoderPool::worker() {
+    while (true) {
+        int index;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [&] { return stopping || !work.empty(); });
+            if (stopping)
+                return;
+            index = work.front();
+            work.pop_front();
+        }
+
+        Slot& slot = slots[index];
+        Output out;
+        encode(slot, out);
+        uint64_t ticket = slot.ticket;
+        slot.image.release();
+        slot.targets.clear();
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            free_slots.push_back(index);
+        }
+        complete(ticket, std::move(out));
+    }
+}
+
+void JpegEncoderPool::encode(Slot& slot, Output& out) {
+    cv::Mat image = slot.image;
+    if (image.empty()) {
+        if (slot.jpeg.empty())
+            return;
+        image = cv::imdecode(slot.jpeg, cv::IMREAD_COLOR);
+        if (image.empty())
+            return;   // Corrupt frame
+    }
+
+    cv::Mat resized;
+    for (const EncodeTarget& target : slot.targets) {
+        const StreamProfile& p = target.profile;
+        const int crop_width = static_cast<int>(image.cols * p.crop);
+        const int x_offset = (image.cols - crop_width) / 2;
+
+        cv::Rect roi(x_offset, 0, crop_width, image.rows);
+        cv::Mat cropped = image(roi);
+        if (p.width > 0 && p.width < crop_width) {
+            const int height = cropped.rows * p.width / crop_width;
+            cv::resize(cropped, resized, cv::Size(p.width, height), 0, 0, cv::INTER_AREA);
+            cropped = resized;
+        }
+
+        std::shared_ptr<EncodedFrame> frame = frames.acquire();
+        frame->seq = slot.seq;
+        frame->captured = slot.captured;
+        frame->camera_seq = slot.camera_seq;
+        cv::imencode(".jpg", cropped, frame->jpg, {cv::IMWRITE_JPEG_QUALITY, p.quality});
+        if (!frame->jpg.empty())
+            out.emplace_back(target.hub, std::move(frame));
+    }
+}
+
+void JpegEncoderPool::complete(uint64_t ticket, Output out) {
+    // Failed frames are recorded as empty so they don't hold back later ones
+    std::lock_guard<std::mutex> lock(reorder_mtx);
+    finished[ticket] = std::move(out);
+    for (auto it = finished.begin(); it != finished.end() && it->first == next_out; it = finished.erase(it)) {
+        for (auto& [hub, frame] : it->second) {
+            if (metrics.tracing())
+                metrics.record(TraceStage::Encode, std::chrono::steady_clock::now() - frame->captured);
+            metrics.count(TraceCounter::FramesEncoded);
+            hub->publish(std::move(frame));
+        }
+        ++next_out;
+    }
+}
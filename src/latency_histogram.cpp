@@ -0,0 +1,67 @@
+#include "latency_histogram.hpp"
+
+#include <algorithm>
+
+// Values below 8 us get a bucket each, above that 8 per power of two
+int LatencyHistogram::bucketOf(uint64_t us) {
+    if (us < sub_buckets)
+        return static_cast<int>(us);
+    int octave = 63 - __builtin_clzll(us);     // us >= 2^octave, octave >= 3
+    int sub = static_cast<int>((us >> (octave - 3)) & (sub_buckets - 1));
+    return std::min((octave - 2) * sub_buckets + sub, bucket_count - 1);
+}
+
+double LatencyHistogram::upperBound(int bucket) {
+    if (bucket < sub_buckets)
+        return bucket + 1;
+    int octave = bucket / sub_buckets + 2;
+    int sub = bucket % sub_buckets;
+    return static_cast<double>(uint64_t(sub_buckets + sub + 1) << (octave - 3));
+}
+
+void LatencyHistogram::record(std::chrono::nanoseconds duration) {
+    uint64_t ns = duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0;
+    buckets[bucketOf(ns / 1000)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum_ns.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t seen = min_ns.load(std::memory_order_relaxed);
+    while (ns < seen && !min_ns.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {}
+    seen = max_ns.load(std::memory_order_relaxed);
+    while (ns > seen && !max_ns.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {}
+}
+
+double LatencyHistogram::percentile(double q, uint64_t total) const {
+    uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total - 1)) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < bucket_count; ++i) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return upperBound(i);
+    }
+    return upperBound(bucket_count - 1);
+}
+
+LatencyHistogram::Summary LatencyHistogram::summary() const {
+    Summary s;
+    s.count = count.load(std::memory_order_relaxed);
+    if (s.count == 0)
+        return s;
+    s.min_us = min_ns.load(std::memory_order_relaxed) / 1000.0;
+    s.max_us = max_ns.load(std::memory_order_relaxed) / 1000.0;
+    s.mean_us = sum_ns.load(std::memory_order_relaxed) / 1000.0 / static_cast<double>(s.count);
+    // Buckets may run slightly ahead of count while a record is in progress
+    s.p50_us = std::min(percentile(0.50, s.count), s.max_us);
+    s.p90_us = std::min(percentile(0.90, s.count), s.max_us);
+    s.p99_us = std::min(percentile(0.99, s.count), s.max_us);
+    s.p999_us = std::min(percentile(0.999, s.count), s.max_us);
+    return s;
+}
+
+void LatencyHistogram::reset() {
+    for (auto& bucket : buckets)
+        bucket.store(0, std::memory_order_relaxed);
+    count.store(0, std::memory_order_relaxed);
+    sum_ns.store(0, std::memory_order_relaxed);
+    min_ns.store(UINT64_MAX, std::memory_order_relaxed);
+    max_ns.store(0, std::memory_order_relaxed);
+}
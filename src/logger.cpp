@@ -0,0 +1,227 @@
+#include "logger.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+
+struct Logger::Ring {
+    static_assert((Constants::log_ring_records & (Constants::log_ring_records - 1)) == 0,
+                  "log_ring_records must be a power of two");
+    std::vector<LogRecord> slots = std::vector<LogRecord>(Constants::log_ring_records);
+    alignas(64) std::atomic<uint64_t> head{0};     // Next record to drain, drain thread only
+    alignas(64) std::atomic<uint64_t> tail{0};     // Next record to write, owner thread only
+    std::atomic<bool> orphaned{false};             // Owner thread exited, free once drained
+};
+
+Logger& logger() {
+    static Logger instance;
+    return instance;
+}
+
+Logger::Logger() : drain_thread(&Logger::drainLoop, this) {}
+
+Logger::~Logger() {
+    stop();
+}
+
+void Logger::stop() {
+    if (running.exchange(false) && drain_thread.joinable())
+        drain_thread.join();
+}
+
+uint64_t Logger::dropped() const {
+    return dropped_total.load(std::memory_order_relaxed);
+}
+
+Logger::Ring* Logger::ring() {
+    // Outlives the thread until the drain thread has emptied it
+    struct Handle {
+        std::shared_ptr<Ring> ring;
+        ~Handle() {
+            if (ring)
+                ring->orphaned.store(true, std::memory_order_release);
+        }
+    };
+    thread_local Handle handle;
+    if (!handle.ring) {
+        handle.ring = std::make_shared<Ring>();
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(handle.ring);
+    }
+    return handle.ring.get();
+}
+
+bool Logger::reserve(Ring*& ring, LogRecord*& record) {
+    thread_local LogRecord direct;  // Written synchronously once the drain thread is gone
+    if (!running.load(std::memory_order_acquire)) {
+        ring = nullptr;
+        record = &direct;
+    } else {
+        ring = this->ring();
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        if (tail - ring->head.load(std::memory_order_acquire) >= ring->slots.size()) {
+            dropped_total.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        record = &ring->slots[tail & (ring->slots.size() - 1)];
+    }
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);     // vDSO, no syscall
+    record->timestamp_ns = static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+    return true;
+}
+
+void Logger::commit(Ring* ring, const LogRecord& record) {
+    if (ring) {
+        ring->tail.store(ring->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        return;
+    }
+    std::string line;
+    format(record, line);
+    output(record, line);
+}
+
+void Logger::drainLoop() {
+    std::vector<LogRecord> batch;
+    std::string line;
+    while (running.load(std::memory_order_acquire)) {
+        drainOnce(batch, line);
+        std::this_thread::sleep_for(Constants::log_flush_interval);
+    }
+    // Threads may still be writing into their rings until they see running
+    // go false, give them a moment before the last pass
+    std::this_thread::sleep_for(Constants::log_flush_interval);
+    drainOnce(batch, line);
+}
+
+size_t Logger::drainOnce(std::vector<LogRecord>& batch, std::string& line) {
+    std::vector<std::shared_ptr<Ring>> current;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        current = rings;
+    }
+
+    batch.clear();
+    for (const auto& ring : current) {
+        bool orphaned = ring->orphaned.load(std::memory_order_acquire);
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        uint64_t tail = ring->tail.load(std::memory_order_acquire);
+        for (; head != tail; ++head)
+            batch.push_back(ring->slots[head & (ring->slots.size() - 1)]);
+        ring->head.store(head, std::memory_order_release);
+        if (orphaned) {
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            rings.erase(std::remove(rings.begin(), rings.end(), ring), rings.end());
+        }
+    }
+
+    // Each ring is in order already, this interleaves the threads
+    std::stable_sort(batch.begin(), batch.end(), [](const LogRecord& a, const LogRecord& b) {
+        return a.timestamp_ns < b.timestamp_ns;
+    });
+    for (const LogRecord& record : batch) {
+        format(record, line);
+        output(record, line);
+    }
+
+    static uint64_t reported = 0;
+    uint64_t dropped = dropped_total.load(std::memory_order_relaxed);
+    if (dropped != reported) {
+        std::fprintf(stderr, "[warn] %llu log messages dropped, ring full\n",
+                     static_cast<unsigned long long>(dropped - reported));
+        reported = dropped;
+    }
+    if (!batch.empty()) {
+        std::fflush(stdout);
+        std::fflush(stderr);
+    }
+    return batch.size();
+}
+
+void Logger::output(const LogRecord& record, const std::string& line) {
+    std::FILE* stream = record.level >= LogLevel::Warn ? stderr : stdout;
+    std::fwrite(line.data(), 1, line.size(), stream);
+}
+
+void Logger::format(const LogRecord& record, std::string& out) {
+    static const char* prefixes[] = {"[debug] ", "", "[warn] ", "[error] "};
+    char buffer[64];
+
+    time_t seconds = static_cast<time_t>(record.timestamp_ns / 1000000000ull);
+    tm local;
+    localtime_r(&seconds, &local);
+    size_t n = std::strftime(buffer, sizeof(buffer), "%H:%M:%S", &local);
+    std::snprintf(buffer + n, sizeof(buffer) - n, ".%03u ",
+                  static_cast<unsigned>(record.timestamp_ns / 1000000ull % 1000));
+    out = buffer;
+    out += prefixes[static_cast<size_t>(record.level)];
+
+    // Replace each "{}" with the next argument, in order
+    size_t offset = 0;
+    for (const char* p = record.format; *p; ++p) {
+        if (p[0] != '{' || p[1] != '}' || offset >= record.size) {
+            out += *p;
+            continue;
+        }
+        ++p;
+        uint8_t tag = record.payload[offset++];
+        switch (tag) {
+            case 'i': {
+                int64_t v;
+                std::memcpy(&v, record.payload + offset, sizeof(v));
+                offset += sizeof(v);
+                out += std::to_string(v);
+                break;
+            }
+            case 'u': {
+                uint64_t v;
+                std::memcpy(&v, record.payload + offset, sizeof(v));
+                offset += sizeof(v);
+                out += std::to_string(v);
+                break;
+            }
+            case 'd': {
+                double v;
+                std::memcpy(&v, record.payload + offset, sizeof(v));
+                offset += sizeof(v);
+                std::snprintf(buffer, sizeof(buffer), "%g", v);    // Same as std::cout
+                out += buffer;
+                break;
+            }
+            case 'b':
+                out += record.payload[offset++] ? "true" : "false";
+                break;
+            case 'c':
+                out += static_cast<char>(record.payload[offset++]);
+                break;
+            case 's': {
+                size_t size = record.payload[offset++];
+                out.append(reinterpret_cast<const char*>(record.payload + offset), size);
+                offset += size;
+                break;
+            }
+            default:
+                offset = record.size;   // Corrupt, stop substituting
+                break;
+        }
+    }
+    out += '\n';
+}
+
+void Logger::put(LogRecord& r, uint8_t tag, const void* data, size_t size) {
+    size_t header = tag == 's' ? 2 : 1;
+    if (r.size + header > LogRecord::payload_size)
+        return;
+    size_t room = LogRecord::payload_size - r.size - header;
+    if (size > room) {
+        if (tag != 's')
+            return;
+        size = room;        // Long strings are cut short, numbers never are
+    }
+    size = std::min<size_t>(size, 255);
+    r.payload[r.size++] = tag;
+    if (tag == 's')
+        r.payload[r.size++] = static_cast<uint8_t>(size);
+    std::memcpy(r.payload + r.size, data, size);
+    r.size = static_cast<uint8_t>(r.size + size);
+}
@@ -1,20 +1,37 @@
 #include "constants.hpp"
 #include "camera_stream.hpp"
+#include "logger.hpp"
 #include "motor_control.hpp"
+#include "realtime.hpp"
+#include "trajectory_planner.hpp"
+#include "workspace_map.hpp"
 
 #include <iostream>
 #include <signal.h>
 #include <thread>
 #include <atomic>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <arpa/inet.h>
 #include <cstdio>
 #include <cctype>  // for std::isprint
+#include <cstdlib>
+#include <cstring>
+#include <string>
 
 std::atomic<bool> go_shutdown{false};
+int shutdown_event = -1;
 
-void onSignal(int) {
+void requestShutdown() {
     go_shutdown.store(true, std::memory_order_relaxed);  // async‑signal‑safe
+    uint64_t one = 1;
+    ssize_t n = write(shutdown_event, &one, sizeof(one)); // Never read, stays readable
+    (void)n;
+}
+
+void onSignal(int) {
+    requestShutdown();
 }
 
 void print_raw(const char* data, size_t len) {
@@ -37,16 +54,67 @@ void print_raw(const char* data, size_t len) {
     }
 }
 
-int main()
+int main(int argc, char** argv)
 {
-    bool ev3_started = start_ev3_script();
+    bool realtime = false;
+    std::string ev3_host = Constants::EV3_IP;
+    int ev3_port = Constants::PORT;
+    bool ev3_given = false;     // Already running somewhere, e.g. testing/ev3_sim
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--rt") == 0) {
+            realtime = true;
+        } else if (std::strcmp(argv[i], "--ev3") == 0 && i + 1 < argc) {
+            ev3_host = argv[++i];
+            size_t colon = ev3_host.rfind(':');
+            if (colon != std::string::npos) {
+                ev3_port = std::atoi(ev3_host.c_str() + colon + 1);
+                ev3_host.resize(colon);
+            }
+            ev3_given = ev3_port > 0 && ev3_port < 65536 && !ev3_host.empty();
+            if (!ev3_given) {
+                std::cerr << "Bad --ev3 address " << argv[i] << "\n";
+                return 1;
+            }
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--rt] [--ev3 host[:port]]\n"
+                      << "  --rt    SCHED_FIFO motor thread on its own core, memory locked\n"
+                      << "  --ev3   connect to an EV3 script that is already running, no ssh\n";
+            return 1;
+        }
+    }
+
+    if (realtime) {
+        // Before any thread starts, so they all inherit the affinity and the
+        // locking; that includes the log drain thread, started by the first
+        // log call. A failed avoidCpu leaves nothing for it to inherit.
+        avoidCpu(Constants::rt_cpu);
+        lockMemory();
+    }
+
+    shutdown_event = eventfd(0, EFD_CLOEXEC);
+    if (shutdown_event < 0) {
+        logError("eventfd failed");
+        return 1;
+    }
+
+    // Build the reachability grid before any job or detection needs it
+    const WorkspaceMap& workspace = workspaceMap();
+    logInfo("Workspace map {}x{} cells ready.", workspace.cols(), workspace.rows());
+    size_t detours = TrajectoryPlanner::prepareDetours();
+    if (int failed = TrajectoryPlanner::checkDetours())
+        logWarn("{} of the detour checks failed, moves around the base will go out as plain MOTOR.", failed);
+    else
+        logInfo("{} detour waypoints ready.", detours);
+
+    bool ev3_started = ev3_given || start_ev3_script();
     int sockfd = -1;
+    Ev3Protocol protocol;
     std::thread motorThread;
     bool motorThreadStarted = false;
 
     try {
         if (ev3_started) {
-            sockfd = connect_to_ev3(Constants::EV3_IP, Constants::PORT);
+            sockfd = connect_to_ev3(ev3_host.c_str(), ev3_port, protocol);
             if (sockfd < 0) {
                 throw std::runtime_error("Failed to connect to EV3");
             }
@@ -59,32 +127,32 @@ int main()
 
         // Start the EV3 motor thread (if connected)
         if (ev3_started) {
-            motorThread = std::thread(motorLoop, sockfd);
+            motorThread = std::thread(motorLoop, sockfd, protocol, realtime);
             motorThreadStarted = true;
         }
 
         // Wait for shutdown signal
-        while (!go_shutdown.load(std::memory_order_relaxed)) {
-            pause();
-        }
+        pollfd pfd{shutdown_event, POLLIN, 0};
+        while (poll(&pfd, 1, -1) <= 0) {}
 
     } catch (const std::exception& e) {
-        std::cerr << "[error] Exception: " << e.what() << '\n';
+        logError("Exception: {}", e.what());
     }
 
     // CLEANUP
     stop_mjpeg_server();
 
+    requestShutdown();  // Ensure motor thread sees the shutdown signal
     if (motorThreadStarted && motorThread.joinable()) {
-        go_shutdown.store(true);  // Ensure motor thread sees the shutdown signal
-        motorThread.join();
+        motorThread.join();     // Sends SHUTDOWN to the EV3 before it returns
     }
-    
-    if (ev3_started) {
-        std::string message = "SHUTDOWN";
-        send(sockfd, message.c_str(), message.size(), 0);
+
+    if (ev3_started && sockfd >= 0) {
+        if (!motorThreadStarted)
+            send_ev3_shutdown(sockfd, protocol);
         shutdown(sockfd, SHUT_RDWR);
     }
-    std::cout << "Shutdown complete.\n";
+    logInfo("Shutdown complete.");
+    logger().stop();    // Flush before the process exits
     return 0;
 }
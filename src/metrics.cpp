@@ -0,0 +1,54 @@
+#include "metrics.hpp"
+#include "constants.hpp"
+
+#include <cstdio>
+
+Metrics metrics;
+
+static const char* stageName(size_t stage) {
+    static const char* names[] = {"capture", "encode", "stream_send", "job_queue",
+                                  "ik", "ev3_send", "ev3_done", "job_total"};
+    static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(TraceStage::Count));
+    return names[stage];
+}
+
+static const char* counterName(size_t counter) {
+    static const char* names[] = {"frames_captured_total", "frames_encoded_total", "frames_sent_total",
+                                  "jobs_received_total", "jobs_unreachable_total", "ev3_commands_total",
+                                  "ev3_acks_total", "ev3_errors_total"};
+    static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(TraceCounter::Count));
+    return names[counter];
+}
+
+void Metrics::scraped() {
+    int64_t until = coarseMs() + std::chrono::duration_cast<std::chrono::milliseconds>(Constants::metrics_trace_window).count();
+    trace_until.store(until, std::memory_order_relaxed);
+}
+
+void Metrics::render(std::string& out) const {
+    char line[160];
+    out += "# HELP raspberry_stage_latency_seconds Latency of each frame and job stage\n"
+           "# TYPE raspberry_stage_latency_seconds summary\n";
+    for (size_t i = 0; i < stages.size(); ++i) {
+        LatencyHistogram::Summary s = stages[i].summary();
+        const std::pair<const char*, double> quantiles[] = {
+            {"0.5", s.p50_us}, {"0.9", s.p90_us}, {"0.99", s.p99_us}, {"0.999", s.p999_us}};
+        for (const auto& [quantile, us] : quantiles) {
+            std::snprintf(line, sizeof(line), "raspberry_stage_latency_seconds{stage=\"%s\",quantile=\"%s\"} %.6f\n",
+                          stageName(i), quantile, us / 1e6);
+            out += line;
+        }
+        std::snprintf(line, sizeof(line), "raspberry_stage_latency_seconds_sum{stage=\"%s\"} %.6f\n",
+                      stageName(i), s.mean_us * static_cast<double>(s.count) / 1e6);
+        out += line;
+        std::snprintf(line, sizeof(line), "raspberry_stage_latency_seconds_count{stage=\"%s\"} %llu\n",
+                      stageName(i), static_cast<unsigned long long>(s.count));
+        out += line;
+    }
+
+    for (size_t i = 0; i < counters.size(); ++i) {
+        std::snprintf(line, sizeof(line), "# TYPE raspberry_%s counter\nraspberry_%s %llu\n", counterName(i),
+                      counterName(i), static_cast<unsigned long long>(counters[i].load(std::memory_order_relaxed)));
+        out += line;
+    }
+}
@@ -0,0 +1,42 @@
+#include "motion_gate.hpp"
+
+// Thumbnail width; the table only needs to be coarse to spot a moving arm or cylinder
+static constexpr int THUMB_WIDTH = 160;
+
+MotionGate::MotionGate(int pixel_threshold, double changed_fraction, std::chrono::milliseconds keepalive)
+    : pixel_threshold(pixel_threshold), changed_fraction(changed_fraction), keepalive(keepalive) {}
+
+bool MotionGate::thumbnail(const cv::Mat& image, const unsigned char* jpeg, size_t jpeg_size) {
+    if (!image.empty()) {
+        const int height = image.rows * THUMB_WIDTH / image.cols;
+        cv::resize(image, small, cv::Size(THUMB_WIDTH, height), 0, 0, cv::INTER_AREA);
+        cv::cvtColor(small, gray, cv::COLOR_BGR2GRAY);
+    } else if (jpeg) {
+        // libjpeg scales by 1/8 during the IDCT, far cheaper than a full decode
+        cv::Mat raw(1, static_cast<int>(jpeg_size), CV_8UC1, const_cast<unsigned char*>(jpeg));
+        gray = cv::imdecode(raw, cv::IMREAD_REDUCED_GRAYSCALE_8);
+    } else {
+        return false;
+    }
+    return !gray.empty();
+}
+
+bool MotionGate::shouldSend(const cv::Mat& image, const unsigned char* jpeg, size_t jpeg_size,
+                            std::chrono::steady_clock::time_point now) {
+    if (!thumbnail(image, jpeg, jpeg_size))
+        return true;   // Can't judge it, let the encoder deal with it
+
+    bool send = forced || now - last_sent >= keepalive || reference.size() != gray.size();
+    if (!send) {
+        cv::absdiff(gray, reference, diff);
+        cv::threshold(diff, diff, pixel_threshold, 255, cv::THRESH_BINARY);
+        send = cv::countNonZero(diff) > changed_fraction * diff.total();
+    }
+
+    if (send) {
+        gray.copyTo(reference);
+        last_sent = now;
+        forced = false;
+    }
+    return send;
+}
@@ -3,16 +3,34 @@
 #include "camera_stream.hpp"
 #include "KSolver.hpp"
 #include "SocketLineReader.hpp"
+#include "ev3_frame.hpp"
+#include "event_loop.hpp"
+#include "trajectory_planner.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "pick_sequencer.hpp"
+#include "realtime.hpp"
+#include "workspace_map.hpp"
 #include <nlohmann/json.hpp>
 
-#include <iostream>
 #include <string>
 #include <thread>
 #include <chrono>
 #include <arpa/inet.h>  // For socket functions
+#include <netdb.h>
+#include <cstdio>
 #include <cstring>      // For memset()
 #include <unistd.h> // for close()
+#include <sys/epoll.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
 #include <cmath>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <string_view>
 
 bool start_ev3_script() {    
     using namespace Constants;
@@ -20,75 +38,145 @@ bool start_ev3_script() {
     // Start the Python script on the EV3
     std::string ssh_command = std::string(EV3_SSH_P1) + EV3_SCRIPT + EV3_SSH_P2;
     
-    std::cout << "Starting Python script on EV3...\n";
+    logInfo("Starting Python script on EV3...");
     int result = system(ssh_command.c_str());
     if (result != 0) {
-        std::cerr << "Failed to launch script on EV3\n";
+        logError("Failed to launch script on EV3");
         return false;
     }
     
-    std::cout << "Python script started\n";
-    std::cout << "Waiting 5 seconds for EV3 to be ready...\n";
+    logInfo("Python script started");
+    logInfo("Waiting 5 seconds for EV3 to be ready...");
     std::this_thread::sleep_for(std::chrono::seconds(5));  // Wait for the server to start
     
     return true;
 }
 
-int connect_to_ev3(const char* ip, int port) {
+int connect_to_ev3(const char* ip, int port, Ev3Protocol& protocol) {
     int sockfd;
     struct sockaddr_in serv_addr;
     
     int retry_count = 0;
 
+    // Numeric address, or a name such as "localhost" for testing/ev3_sim
+    in_addr address{};
+    if (inet_pton(AF_INET, ip, &address) != 1) {
+        addrinfo hints{};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        if (getaddrinfo(ip, nullptr, &hints, &found) != 0 || found == nullptr) {
+            logError("Unknown EV3 host {}", ip);
+            return -1;
+        }
+        address = reinterpret_cast<sockaddr_in*>(found->ai_addr)->sin_addr;
+        freeaddrinfo(found);
+    }
+
     while (true) {
         sockfd = socket(AF_INET, SOCK_STREAM, 0);
         if (sockfd < 0) {
-            std::cerr << "Socket creation failed\n";
+            logError("Socket creation failed");
             return -1;
         }
 
         std::memset(&serv_addr, 0, sizeof(serv_addr));
         serv_addr.sin_family = AF_INET;
         serv_addr.sin_port = htons(port);
-        inet_pton(AF_INET, ip, &serv_addr.sin_addr);
+        serv_addr.sin_addr = address;
 
-        std::cout << "Trying to connect to EV3...\n";
+        logInfo("Trying to connect to EV3...");
         if (connect(sockfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) == 0) {
-            std::cout << "Connected to EV3!\n";
+            logInfo("Connected to EV3!");
             break;
         }
 
         close(sockfd);
-        std::cerr << "Connection attempt " << ++retry_count << " , retrying...\n";
+        logWarn("Connection attempt {}, retrying...", ++retry_count);
         
         if (retry_count >= 7) {
-            std::cerr << "Failed to connect to EV3 after 7 attempts.\n";
+            logError("Failed to connect to EV3 after 7 attempts.");
             return -1;
         }
         std::this_thread::sleep_for(std::chrono::seconds(2));  // Retry every second
     }
 
     SocketLineReader reader(sockfd);
-    std::string line;
+    std::string_view line;
+    const int ready_timeout_ms = static_cast<int>(Constants::ev3_ready_timeout.count());
     // Wait for the EV3 to be ready
     while (true) {
-        if (!reader.readLine(line)) {
-            std::cerr << "Read error.\n";
-            std::cerr << "Failed to initialize EV3 script.\n";
+        auto status = reader.readLine(line, ready_timeout_ms);
+        if (status != SocketLineReader::Status::Line) {
+            logError("{} Failed to initialize EV3 script.",
+                     status == SocketLineReader::Status::Timeout ? "Timed out waiting for EV3." : "Read error.");
+            close(sockfd);
             return -1;
         }
 
-        if (line == "RDY") {
-            std::cout << "EV3 is ready to receive commands.\n";
+        if (line.compare(0, 3, "RDY") == 0) {
+            logInfo("EV3 is ready to receive commands.");
             break;
         } else {
-            std::cout << "EV3: " << line << "\n";
+            logInfo("EV3: {}", line);
         }
     }
 
+    // "RDY" may list capabilities; older scripts send none and stay stop-and-wait
+    protocol = Ev3Protocol();
+    // Binary frames carry a sequence number, so they are only used on top of SEQ
+    std::string caps = std::string(line) + " ";
+    if (caps.find(" SEQ ") != std::string::npos && Constants::ev3_pipeline_window > 1) {
+        bool binary = Constants::ev3_binary_frames && caps.find(" BIN1 ") != std::string::npos;
+        bool setpoints = Constants::trajectory_enabled && caps.find(" SP ") != std::string::npos;
+        bool velocity = caps.find(" VEL ") != std::string::npos;
+        std::string request = std::string("PROTO SEQ") + (binary ? " BIN1" : "") + (setpoints ? " SP" : "") +
+                              (velocity ? " VEL" : "");
+        std::string message = request + "\n";
+        send(sockfd, message.c_str(), message.size(), 0);
+        auto status = reader.readLine(line, ready_timeout_ms);
+        if (status != SocketLineReader::Status::Line) {
+            logError("{} EV3 did not confirm protocol {}.",
+                     status == SocketLineReader::Status::Timeout ? "Timed out waiting for EV3." : "Read error.",
+                     request);
+            close(sockfd);
+            return -1;
+        }
+        if (line != request) {
+            logError("EV3 refused protocol {}: {}", request, line);
+            close(sockfd);
+            return -1;
+        }
+        protocol.sequenced = true;
+        protocol.window = Constants::ev3_pipeline_window;
+        protocol.binary = binary;
+        protocol.setpoints = setpoints;
+        protocol.velocity = velocity;
+        logInfo("Sequenced protocol, {} commands in flight{}{}{}.", protocol.window,
+                binary ? ", binary frames" : "", setpoints ? ", setpoint streaming" : "",
+                velocity ? ", velocity jogging" : "");
+    }
+
     return sockfd;
 }
 
+// STOP and SHUTDOWN carry no sequence number and are never acked
+static void appendEv3Control(const Ev3Protocol& protocol, Ev3Op op, std::vector<uint8_t>& out) {
+    if (protocol.binary) {
+        encodeEv3Control(op, out);
+    } else {
+        std::string message = formatEv3Text({Ev3Step{op}}) + "\n";
+        out.insert(out.end(), message.begin(), message.end());
+    }
+}
+
+// Only for when motorLoop never ran, it sends SHUTDOWN itself on the way out
+void send_ev3_shutdown(int sockfd, const Ev3Protocol& protocol) {
+    std::vector<uint8_t> message;
+    appendEv3Control(protocol, Ev3Op::Shutdown, message);
+    send(sockfd, message.data(), message.size(), MSG_NOSIGNAL);
+}
+
 void resolvePointAABBCollision(double oldX, double oldY, double& newX, double& newY, double left, double top, double right, double bottom) {
     // Check if point is inside the deadzone
     if (newX <= left || newX >= right || newY <= top || newY >= bottom)
@@ -131,8 +219,10 @@ void joystick_to_coordinates(int angle, int distance, double& x, double& y) {
     // Convert joystick angle and distance to coordinates
     double new_x = x + distance * SENSITIVITY * std::cos(angle * PI / 180.0);
     double new_y = y + distance * SENSITIVITY * std::sin(angle * PI / 180.0);
-    // Resolve collision with deadzone
-    resolvePointAABBCollision(x, y, new_x, new_y, deadzone_x_left, deadzone_y_top, deadzone_x_right, deadzone_y_bottom);
+    // Resolve collision with deadzone, "top" being the smaller y
+    resolvePointAABBCollision(x, y, new_x, new_y,
+                              std::min(deadzone_x_left, deadzone_x_right), std::min(deadzone_y_top, deadzone_y_bottom),
+                              std::max(deadzone_x_left, deadzone_x_right), std::max(deadzone_y_top, deadzone_y_bottom));
     x = new_x;
     y = new_y;
 }
@@ -218,16 +308,19 @@ void coordsJobParse(nlohmann::json j, double &x, double &y) {
     y = j["y"];
 }
 
-std::string grabJobParse(nlohmann::json j) {
+bool grabJobParse(nlohmann::json j, bool& grab) {
     std::string state = j["state"];
-    return std::string("GRABBER ") + state + "\n";
+    grab = state == "on";
+    return grab || state == "off";
 }
 
 bool computeAngles(double x, double y, double &outA, double &outB) {
     using namespace Constants;
-    // Initialize the IK solver
-    KSolver kSolver(L1, L2, offset);
+    // Reject from the precomputed map before solving anything
+    if (!workspaceMap().reachable(x, y))
+        return false;
 
+    static KSolver kSolver(L1, L2, offset);
     bool reachable = kSolver.calculateIK(x, y, outA, outB);
     
     // Convert angles to degrees
@@ -241,63 +334,608 @@ bool computeAngles(double x, double y, double &outA, double &outB) {
     return reachable;
 }
 
-void motorLoop(int sockfd) {
+// Turn a job into the steps the EV3 should run. "sequence" jobs
+// ({"type":"sequence","steps":[...]}) become one PLAN command.
+// Returns false if nothing should be sent.
+static bool buildSteps(const nlohmann::json& j, std::vector<Ev3Step>& steps, bool sequenced) {
+    const std::string type = j.at("type");
+    if (type == "coords") {
+        double x = 0.0, y = 0.0;
+        Ev3Step step{Ev3Op::Motor};
+        coordsJobParse(j, x, y);
+        if (!computeAngles(x, y, step.a, step.b)) {
+            logWarn("Target coordinates ({}, {}) are unreachable.", x, y);
+            metrics.count(TraceCounter::JobsUnreachable);
+            send_ws_message("UNR"); // UNREACHABLE
+            return false;
+        }
+        steps.push_back(step);
+        return true;
+    } else if (type == "grip") {
+        Ev3Step step{Ev3Op::Grabber};
+        if (!grabJobParse(j, step.grab)) {
+            logWarn("Unknown grabber state: {}", j["state"].dump());
+            return false;
+        }
+        steps.push_back(step);
+        return true;
+    } else if (type == "sequence") {
+        if (!sequenced) {
+            logWarn("EV3 script does not support sequences.");
+            return false;
+        }
+        // Check every step first, a plan is all or nothing
+        for (const auto& step : j.at("steps")) {
+            if (step.at("type") == "sequence" || !buildSteps(step, steps, sequenced))
+                return false;
+        }
+        if (steps.empty() || steps.size() > 255) {
+            logWarn("Sequence must have 1 to 255 steps.");
+            return false;
+        }
+        return true;
+    }
+    logWarn("Unknown JSON type: {}", type);
+    return false;
+}
+
+// Points of a batch job, {"x":..,"y":..} with an optional "color" of
+// "grey" or "black" (same numbering as CylinderColor)
+static void batchPointsParse(const nlohmann::json& j, std::vector<PickPoint>& points) {
+    for (const auto& point : j) {
+        PickPoint p{point.at("x"), point.at("y")};
+        if (point.contains("color")) {
+            std::string color = point.at("color");
+            std::transform(color.begin(), color.end(), color.begin(),
+                           [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            p.color = color == "black" ? 1 : (color == "grey" ? 0 : -1);
+        }
+        points.push_back(p);
+    }
+}
+
+// "batch" jobs ({"type":"batch","picks":[...],"drops":[...]}) move every
+// pick to a free drop slot of its color, in the order that keeps the joints
+// travelling the least, starting from (from_x, from_y). The whole run goes
+// out as one PLAN and the chosen order is reported back as "batch_plan".
+static bool buildBatch(const nlohmann::json& j, double from_x, double from_y, std::vector<Ev3Step>& steps, bool sequenced) {
+    if (!sequenced) {
+        logWarn("EV3 script does not support sequences.");
+        return false;
+    }
+    std::vector<PickPoint> picks, drops;
+    batchPointsParse(j.at("picks"), picks);
+    batchPointsParse(j.at("drops"), drops);
+
+    PickPlan plan;
+    planPickSequence(from_x, from_y, picks, drops, plan);
+    if (plan.pairs.size() * 4 > 255) {
+        // Drop the tail rather than the whole job, the rest can go in a second batch
+        for (size_t i = 255 / 4; i < plan.pairs.size(); ++i)
+            plan.skipped.push_back(plan.pairs[i].first);
+        plan.pairs.resize(255 / 4);
+        std::sort(plan.skipped.begin(), plan.skipped.end());
+    }
+
+    nlohmann::json report = {{"type", "batch_plan"}, {"order", plan.pairs},
+                             {"skipped", plan.skipped}, {"time_s", plan.travel_time}};
+    send_ws_message(report.dump());
+    if (plan.pairs.empty()) {
+        logWarn("Batch has no pick that can be placed.");
+        send_ws_message("UNR"); // UNREACHABLE
+        return false;
+    }
+
+    for (const auto& [pick, drop] : plan.pairs) {
+        // Both ends were checked against the workspace map and solved by the planner
+        const auto& [pick_a, pick_b] = plan.pick_angles[pick];
+        const auto& [drop_a, drop_b] = plan.drop_angles[drop];
+        steps.push_back({Ev3Op::Motor, pick_a, pick_b});
+        steps.push_back({Ev3Op::Grabber, 0.0, 0.0, true});
+        steps.push_back({Ev3Op::Motor, drop_a, drop_b});
+        steps.push_back({Ev3Op::Grabber, 0.0, 0.0, false});
+    }
+    logInfo("Batch of {} pick(s), {} skipped, {} s of travel.", plan.pairs.size(), plan.skipped.size(),
+            plan.travel_time);
+    return true;
+}
+
+// Non-blocking writes to the EV3. Whatever send() doesn't take right away
+// waits here until epoll reports the socket writable again.
+class Ev3Output {
+public:
+    Ev3Output(EventLoop& loop, int fd) : loop(loop), fd(fd) {}
+
+    void write(const uint8_t* data, size_t size) {
+        if (pending.empty()) {
+            ssize_t n = send(fd, data, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                fail();
+                return;
+            }
+            size_t done = n > 0 ? static_cast<size_t>(n) : 0;
+            if (done == size) return;
+            data += done;
+            size -= done;
+        }
+        pending.insert(pending.end(), data, data + size);
+        watch(true);
+    }
+
+    void write(const std::vector<uint8_t>& data) { write(data.data(), data.size()); }
+    void write(const std::string& data) { write(reinterpret_cast<const uint8_t*>(data.data()), data.size()); }
+
+    // Called when the socket is writable
+    void flush() {
+        while (sent < pending.size()) {
+            ssize_t n = send(fd, pending.data() + sent, pending.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+                fail();
+                return;
+            }
+            sent += static_cast<size_t>(n);
+        }
+        pending.clear();
+        sent = 0;
+        watch(false);
+    }
+
+    bool empty() const { return pending.empty(); }
+
+private:
+    EventLoop& loop;
+    int fd;
+    std::vector<uint8_t> pending;
+    size_t sent = 0;
+    bool writable_watched = false;
+
+    // Nothing in flight can be acked any more, so end the loop like a read error
+    void fail() {
+        logError("Send to EV3 failed: {}", std::strerror(errno));
+        pending.clear();
+        sent = 0;
+        watch(false);
+        loop.stop();
+    }
+
+    void watch(bool writable) {
+        if (writable == writable_watched) return;
+        writable_watched = writable;
+        loop.modify(fd, EPOLLIN | EPOLLRDHUP | (writable ? EPOLLOUT : 0u));
+    }
+};
+
+ControlTiming control_timing;
+
+void motorLoop(int sockfd, Ev3Protocol protocol, bool realtime) {
     using namespace Constants;
     using json = nlohmann::json;
+    using clock = std::chrono::steady_clock;
+
+    if (realtime) {
+        bool ok = makeThreadRealtime(rt_priority, rt_cpu);
+        prefaultStack(rt_stack_prefault);
+        control_timing.realtime.store(ok, std::memory_order_relaxed);
+        if (ok)
+            logInfo("Motor thread on CPU {} at SCHED_FIFO {}.", rt_cpu, rt_priority);
+    }
+
+    EventLoop loop;
+    Ev3Output output(loop, sockfd);
     SocketLineReader reader(sockfd);
-    std::string line;
+    std::string_view line;
     json j;
 
-    while (!go_shutdown.load(std::memory_order_relaxed)) {
-        if (jobHandler.readLastJob(j)) {
-            bool waitForOK = false;
+    // Commands sent but not yet acked, oldest first. Acks come back in order
+    // because the EV3 runs commands one after another.
+    struct Inflight {
+        uint32_t seq;
+        clock::time_point received;     // Job arrived on the WebSocket, empty unless tracing
+        clock::time_point sent;
+    };
+    std::deque<Inflight> inflight;
+    clock::time_point job_received;     // Of the job fillWindow is working on
+    uint32_t next_seq = 1;
+    std::vector<Ev3Step> steps;
+    std::vector<uint8_t> frame;     // Reused so binary commands don't allocate
+    const size_t window = protocol.sequenced ? std::max(1, protocol.window) : 1;
+    auto last_heard = clock::now();
+    bool closing = false;
+
+    // Where the gripper was last sent, moves are planned from there. Unknown
+    // after a STOP, the next move then goes out as a plain MOTOR.
+    KSolver kSolver(L1, L2, offset);
+    bool arm_known = true;
+    double arm_x = 0.0, arm_y = 0.0;
+    double arm_a = 0.0, arm_b = 0.0;                // Same place as joint angles
+    kSolver.calculateFK(arm_x, arm_y, 0.0, 0.0);   // The EV3 zeroes its encoders at startup
+
+    // Planned move being streamed, one setpoint per control tick. The final
+    // MOTOR is a normal sequenced command, its ack completes the job.
+    TrajectoryPlanner planner(trajectory_max_speed, trajectory_max_accel, control_loop_ms / 1000.0);
+    std::vector<Setpoint> trajectory;
+    size_t trajectory_next = 0;
+    int trajectory_timer = -1;
+    Ev3Step trajectory_end;
+    std::optional<json> held;   // Coords job waiting for the EV3 to go idle
+    clock::time_point trajectory_received;
+
+    // Sized up front so steady-state ticks don't allocate
+    steps.reserve(255);
+    frame.reserve(4096);
+    trajectory.reserve(1024);
+
+    // Joystick jogging: one velocity setpoint per control tick while the
+    // stick is off centre. Jobs stay queued until it is released.
+    int jog_timer = -1;
+    clock::time_point last_tick;    // Previous control tick of the running trajectory or jog
+
+    // Match one line from the EV3 to the command it answers
+    auto acked = [&](const Inflight& command, bool ok) {
+        metrics.count(ok ? TraceCounter::Ev3Acks : TraceCounter::Ev3Errors);
+        metrics.since(TraceStage::Ev3Done, command.sent);
+        metrics.since(TraceStage::JobTotal, command.received);
+    };
+
+    auto handleLine = [&](std::string_view line) {
+        if (line.compare(0, 4, "POS ") == 0) {
+            // Where the arm really is, sent when the EV3 starts jogging from rest
+            double a = 0.0, b = 0.0;
+            const char* end = line.data() + line.size();
+            auto first = std::from_chars(line.data() + 4, end, a);
+            if (first.ec == std::errc() && first.ptr < end && *first.ptr == ' ' &&
+                std::from_chars(first.ptr + 1, end, b).ec == std::errc()) {
+                arm_a = a;
+                arm_b = b;
+            }
+            return;
+        }
+        if (inflight.empty()) {
+            logInfo("EV3: {}", line);
+            return;
+        }
+        if (!protocol.sequenced) {
+            // Stop-and-wait: whatever comes back answers the outstanding command
+            acked(inflight.front(), line.compare(0, 2, "OK") == 0);
+            inflight.pop_front();
+            if (line.compare(0, 2, "OK") != 0) {
+                logInfo("EV3: {}", line);
+                send_ws_message("EV3_RSP"); // EV3 RESPONSE
+            } else {
+                logInfo("Command OK.");
+                send_ws_message("CMP"); // COMPLETED
+            }
+            return;
+        }
+
+        // "OK <seq>" or "ERR <seq> message", parsed in place
+        size_t space = line.find(' ');
+        std::string_view status = line.substr(0, space);
+        uint32_t seq = 0;
+        bool parsed = space != std::string_view::npos && (status == "OK" || status == "ERR");
+        if (parsed) {
+            auto result = std::from_chars(line.data() + space + 1, line.data() + line.size(), seq);
+            parsed = result.ec == std::errc();
+        }
+        if (!parsed) {
+            logInfo("EV3: {}", line);   // Log output, not an ack
+            return;
+        }
+        auto it = std::find_if(inflight.begin(), inflight.end(), [&](const Inflight& c) { return c.seq == seq; });
+        if (it == inflight.end()) {
+            logWarn("Ack for unknown command {}", seq);
+            return;
+        }
+        acked(*it, status == "OK");
+        inflight.erase(it);
+        if (status == "OK") {
+            logInfo("Command {} OK.", seq);
+            send_ws_message("CMP"); // COMPLETED
+        } else if (line.find("stopped", space) != std::string_view::npos) {
+            send_ws_message("CNL"); // CANCELLED
+        } else {
+            logInfo("EV3: {}", line);
+            send_ws_message("EV3_RSP"); // EV3 RESPONSE
+        }
+    };
+
+    auto sendSteps = [&](const std::vector<Ev3Step>& steps, clock::time_point received) {
+        uint32_t seq = next_seq++;
+        if (protocol.binary) {
+            frame.clear();
+            encodeEv3Frame(seq, steps, frame);
+            output.write(frame);
+        } else {
+            std::string command = formatEv3Text(steps);
+            std::string message = protocol.sequenced ? std::to_string(seq) + " " + command + "\n"
+                                                     : command + "\n";
+            logInfo("Sending command: {}", std::string_view(message).substr(0, message.size() - 1));
+            output.write(message);
+        }
+        if (inflight.empty())
+            last_heard = clock::now();  // Silence only counts while something is in flight
+        inflight.push_back({seq, received, metrics.stamp()});
+        metrics.count(TraceCounter::Ev3Commands);
+        metrics.since(TraceStage::Ev3Send, received);
+
+        for (auto it = steps.rbegin(); it != steps.rend(); ++it) {
+            if (it->op == Ev3Op::Motor) {
+                kSolver.calculateFK(arm_x, arm_y, it->a, it->b);
+                arm_a = it->a;
+                arm_b = it->b;
+                arm_known = true;
+                break;
+            }
+        }
+    };
+
+    auto cancelTrajectory = [&]() {
+        if (trajectory_timer >= 0)
+            loop.cancelTimer(trajectory_timer);
+        trajectory_timer = -1;
+        last_tick = clock::time_point();
+        trajectory.clear();
+    };
+
+    // Control tick bookkeeping for control_timing. The period only counts
+    // between ticks of the same run, not the idle time in between.
+    auto timed = [&](auto& handler) {
+        return [&](uint64_t expirations) {
+            auto start = clock::now();
+            if (last_tick != clock::time_point()) {
+                auto period = start - last_tick;
+                auto target = std::chrono::duration_cast<clock::duration>(std::chrono::milliseconds(control_loop_ms));
+                control_timing.period.record(period);
+                control_timing.jitter.record(period > target ? period - target : target - period);
+            }
+            if (expirations > 1)
+                control_timing.overruns.fetch_add(expirations - 1, std::memory_order_relaxed);
+            last_tick = start;   // Cleared again if the handler ends the run
+            handler(expirations);
+            control_timing.work.record(clock::now() - start);
+        };
+    };
+
+    // Setpoints and velocities are streamed without a sequence number or ack
+    auto sendStreamed = [&](const Ev3Step& step) {
+        frame.clear();
+        if (protocol.binary) {
+            encodeEv3Frame(0, {step}, frame);
+        } else {
+            std::string message = formatEv3Text({step}) + "\n";
+            frame.assign(message.begin(), message.end());
+        }
+        output.write(frame);
+    };
+
+    std::function<void()> fillWindow;
+
+    // Streams one setpoint per tick; late ticks skip ahead rather than bunch up
+    auto trajectoryTick = [&](uint64_t expirations) {
+        trajectory_next += expirations - 1;
+        if (trajectory_next + 1 < trajectory.size()) {
+            const Setpoint& sp = trajectory[trajectory_next++];
+            sendStreamed({Ev3Op::Setpoint, sp.a, sp.b});
+            return;
+        }
+        cancelTrajectory();
+        sendSteps({trajectory_end}, trajectory_received);
+        fillWindow();
+    };
+
+    // Returns false if the move can't be planned, it is then sent as is
+    auto startTrajectory = [&](double x, double y, const Ev3Step& end) {
+        if (!planner.plan(arm_x, arm_y, x, y, trajectory) || trajectory.size() < 3) {
+            trajectory.clear();
+            return false;
+        }
+        logInfo("Streaming {} setpoints over {} s to ({}, {}).", trajectory.size(), trajectory.back().t, x, y);
+        trajectory_next = 1;    // The first one is where the arm already is
+        trajectory_end = end;
+        trajectory_received = job_received;
+        trajectory_timer = loop.addTimer(std::chrono::milliseconds(control_loop_ms), timed(trajectoryTick));
+        if (trajectory_timer < 0) {
+            trajectory.clear();
+            return false;
+        }
+        return true;
+    };
+
+    auto sendStop = [&]() {
+        logInfo("Sending command: STOP");
+        frame.clear();
+        appendEv3Control(protocol, Ev3Op::Stop, frame);
+        output.write(frame);
+    };
+
+    auto cancelJog = [&]() {
+        if (jog_timer >= 0)
+            loop.cancelTimer(jog_timer);
+        jog_timer = -1;
+        last_tick = clock::time_point();
+    };
+
+    // Turns the stick into joint speeds through the Jacobian, one tick ahead:
+    // the gripper moves the way joystick_to_coordinates would, slowed down to
+    // the motor speeds and stopped at the joint limits and the edge of reach.
+    auto jogTick = [&](uint64_t expirations) {
+        int angle = 0, distance = 0;
+        if (!jobHandler.readJog(angle, distance)) {
+            // Stick released: hold here and let queued jobs run again
+            cancelJog();
+            sendStreamed(protocol.velocity ? Ev3Step{Ev3Op::Velocity, 0.0, 0.0}
+                                           : Ev3Step{Ev3Op::Setpoint, arm_a, arm_b});
+            kSolver.calculateFK(arm_x, arm_y, arm_a, arm_b);
+            arm_known = true;
+            fillWindow();
+            return;
+        }
+
+        const double dt = control_loop_ms / 1000.0;
+        double x = 0.0, y = 0.0;
+        kSolver.calculateFK(x, y, arm_a, arm_b);
+        double next_x = x, next_y = y;
+        joystick_to_coordinates(angle, distance, next_x, next_y);
+
+        // Stay clear of the singularity, the Jacobian can't be inverted there
+        const double reach = L1 + std::hypot(L2, offset) - jog_reach_margin;
+        double radius = std::hypot(next_x, next_y);
+        if (radius > reach && radius > std::hypot(x, y)) {
+            double scale = std::max(reach, std::hypot(x, y)) / radius;
+            next_x *= scale;
+            next_y *= scale;
+        }
+
+        double va = 0.0, vb = 0.0;
+        kSolver.calculateJointVelocity(arm_a, arm_b, (next_x - x) / dt, (next_y - y) / dt, va, vb);
+        // Motor B turns with joint A plus joint B, like on the EV3
+        double slow = std::max({1.0, std::abs(va) / J1_max_speed, std::abs(va + vb) / J2_max_speed});
+        va /= slow;
+        vb /= slow;
+
+        // A late tick means the EV3 kept the previous speed for longer, so
+        // the limits have to hold over the whole span, not just one tick
+        const double span = dt * static_cast<double>(expirations);
+        if (std::abs(arm_a + va * span) > J1_limit)
+            va = (std::copysign(J1_limit, va) - arm_a) / span;
+        if (std::abs(arm_b + vb * span) > J2_limit)
+            vb = (std::copysign(J2_limit, vb) - arm_b) / span;
+        arm_a += va * span;
+        arm_b += vb * span;
+        sendStreamed(protocol.velocity ? Ev3Step{Ev3Op::Velocity, va, vb}
+                                       : Ev3Step{Ev3Op::Setpoint, arm_a, arm_b});
+    };
+
+    auto startJog = [&]() {
+        // Take over from whatever the arm is doing, from where it was last sent
+        if (trajectory_timer >= 0 && trajectory_next > 0) {
+            arm_a = trajectory[trajectory_next - 1].a;
+            arm_b = trajectory[trajectory_next - 1].b;
+            send_ws_message("CNL"); // CANCELLED, its final MOTOR is never sent
+        }
+        cancelTrajectory();
+        if (!inflight.empty())
+            sendStop();     // Running commands end as "stopped", the EV3 reports where it is
+        jog_timer = loop.addTimer(std::chrono::milliseconds(control_loop_ms), timed(jogTick));
+        if (jog_timer >= 0)
+            logInfo("Jogging.");
+    };
+
+    // Send queued jobs until the window is full
+    fillWindow = [&]() {
+        if (jobHandler.takeStopRequest()) {
+            // Queued jobs are already gone, make sure the arm holds still too
+            cancelJog();
+            if (trajectory_timer >= 0)
+                send_ws_message("CNL"); // CANCELLED, the EV3 never saw it so no "stopped" comes back
+            cancelTrajectory();
+            held.reset();
+            arm_known = false;
+            sendStop();
+        }
+
+        int jog_angle = 0, jog_distance = 0;
+        if (!closing && jog_timer < 0 && (protocol.velocity || protocol.setpoints) &&
+            jobHandler.readJog(jog_angle, jog_distance))
+            startJog();
+
+        while (!closing && trajectory_timer < 0 && jog_timer < 0 && inflight.size() < window) {
+            if (held) {
+                j = std::move(*held);   // job_received still belongs to it
+                held.reset();
+            } else if (jobHandler.readLastJob(j, &job_received)) {
+                metrics.since(TraceStage::JobQueue, job_received);
+            } else {
+                break;
+            }
+
+            bool plan_move = false;
             try {
-                const std::string type = j.at("type");
-                if (type == "coords") {
-                    double x = 0.0, y = 0.0;
-                    double outA = 0.0, outB = 0.0;
-                    coordsJobParse(j, x, y);
-                    if (computeAngles(x, y, outA, outB)) {
-                        // send motor command
-                        char buffer[50];
-                        std::snprintf(buffer, sizeof(buffer), "MOTOR %.2f %.2f\n", outA, outB); // round to 2 decimal places
-                        std::string message(buffer);
-                        std::cout << "Sending command: " << message;
-                        send(sockfd, message.c_str(), message.size(), 0);
-                        waitForOK = true; // Wait for confirmation
-                    } else {
-                        std::cerr << "[warn] Target coordinates (" << x << ", " << y << ") are unreachable.\n";
-                        send_ws_message("UNR"); // UNREACHABLE
-                    }
-
-                } else if (type == "grip") {
-                    std::string message = grabJobParse(j);
-                    std::cout << "Sending command: " << message;
-                    send(sockfd, message.c_str(), message.size(), 0);
-                    waitForOK = true; // Wait for confirmation
-                } else {
-                    std::cerr << "[warn] Unknown JSON type: " << type << std::endl;
+                // Setpoints are only followed while the EV3 has nothing else to do
+                plan_move = protocol.setpoints && arm_known && j.at("type") == "coords";
+                if (plan_move && !inflight.empty()) {
+                    held = std::move(j);
+                    break;
                 }
+                steps.clear();
+                auto build_start = metrics.stamp();
+                // Batches are ordered from wherever the arm was last sent
+                if (j.at("type") == "batch" ? !buildBatch(j, arm_x, arm_y, steps, protocol.sequenced)
+                                            : !buildSteps(j, steps, protocol.sequenced))
+                    continue;
+                metrics.since(TraceStage::Ik, build_start);
             } catch (const std::exception& e) {
-                std::cerr << "[error] Invalid JSON: " << e.what() << std::endl;
+                logError("Invalid JSON: {}", e.what());
+                continue;
             }
-            if (waitForOK) {
-                if (!reader.readLine(line)) {
-                    std::cerr << "Read error in motorLoop.\n";
-                    return;
-                }
-    
-                if (strncmp(line.c_str(), "OK", 2) != 0) {
-                    std::cout << "EV3: " << line << "\n";
-                    send_ws_message("EV3_RSP"); // EV3 RESPONSE
-                } else {
-                    std::cout << "Command OK.\n";
-                    send_ws_message("CMP"); // COMPLETED
-                }
+
+            if (plan_move) {
+                double x = 0.0, y = 0.0;
+                coordsJobParse(j, x, y);
+                if (startTrajectory(x, y, steps.front()))
+                    break;
             }
+            sendSteps(steps, job_received);
         }
-
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
-    }
-    
-}
\ No newline at end of file
+    };
+
+    // Acks and log lines from the EV3
+    loop.add(sockfd, EPOLLIN | EPOLLRDHUP, [&](uint32_t events) {
+        if (events & EPOLLOUT) {
+            output.flush();
+            if (closing && output.empty())
+                loop.stop();
+        }
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            // One read may hold several acks, or only half of one
+            if (!reader.receive()) {
+                logError("Read error in motorLoop.");
+                loop.stop();
+                return;
+            }
+            last_heard = clock::now();
+            while (reader.nextLine(line))
+                handleLine(line);
+            fillWindow();
+        }
+    });
+
+    // New jobs, cancel and stop requests
+    loop.add(jobHandler.eventFd(), EPOLLIN, [&](uint32_t) {
+        uint64_t count;
+        ssize_t n = read(jobHandler.eventFd(), &count, sizeof(count));
+        (void)n;
+        fillWindow();
+    });
+
+    // Shutdown: tell the EV3, then leave once it's on the wire
+    loop.add(shutdown_event, EPOLLIN, [&](uint32_t) {
+        loop.remove(shutdown_event);
+        closing = true;
+        cancelTrajectory();
+        cancelJog();
+        frame.clear();
+        appendEv3Control(protocol, Ev3Op::Shutdown, frame);
+        output.write(frame);
+        if (output.empty())
+            loop.stop();
+        else
+            loop.addTimer(ev3_ready_timeout, [&](uint64_t) { loop.stop(); });   // EV3 stopped reading
+    });
+
+    // A command that is never acked would hold the window forever
+    loop.addTimer(ev3_watchdog_period, [&](uint64_t) {
+        if (inflight.empty() || clock::now() - last_heard < ev3_ack_timeout)
+            return;
+        logWarn("EV3 silent for {} s, giving up on {} command(s).", ev3_ack_timeout.count(), inflight.size());
+        for (size_t i = 0; i < inflight.size(); ++i)
+            send_ws_message("EV3_RSP"); // EV3 RESPONSE
+        inflight.clear();
+        last_heard = clock::now();
+        fillWindow();
+    });
+
+    fillWindow();   // Jobs queued while connecting
+    loop.run();
+}
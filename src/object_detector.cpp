@@ -0,0 +1,111 @@
+#include "object_detector.hpp"
+#include <cmath>
+#include <iostream>
+
+// Same tuning as app/vision.py
+static constexpr double MIN_AXIS = 40;
+static constexpr double MAX_AXIS = 85;
+static constexpr double ASPECT_RATIO_MIN = 0.5;
+static constexpr double ASPECT_RATIO_MAX = 2.0;
+static constexpr double MERGE_DISTANCE = 40;
+static constexpr double BLACK_THRESHOLD = -110;
+static constexpr double GREY_THRESHOLD = -50;
+static constexpr int DIFF_THRESHOLD = 30;
+
+const char* colorName(CylinderColor color) {
+    return color == CylinderColor::Black ? "BLACK" : "GREY";
+}
+
+bool ObjectDetector::loadBackground(const std::string& path) {
+    cv::Mat frame = cv::imread(path, cv::IMREAD_GRAYSCALE);
+    if (frame.empty()) {
+        std::cerr << "[warn] Background image " << path << " not found.\n";
+        return false;
+    }
+    background = frame;
+    return true;
+}
+
+void ObjectDetector::setBackground(const cv::Mat& gray) {
+    gray.copyTo(background);
+}
+
+bool ObjectDetector::detect(const cv::Mat& gray, std::vector<Detection>& out) {
+    out.clear();
+    if (background.empty() || gray.size() != background.size())
+        return false;
+
+    // Background subtraction
+    cv::absdiff(gray, background, diff);
+    cv::threshold(diff, thresh, DIFF_THRESHOLD, 255, cv::THRESH_BINARY);
+    cv::morphologyEx(thresh, thresh, cv::MORPH_OPEN, cv::Mat::ones(3, 3, CV_8UC1));
+
+    std::vector<std::vector<cv::Point>> contours;
+    cv::findContours(thresh, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+
+    // Filter by ellipse size and shape
+    std::vector<size_t> candidates;
+    std::vector<cv::Point2f> centres;
+    for (size_t i = 0; i < contours.size(); ++i) {
+        if (contours[i].size() < 5)
+            continue;
+        cv::RotatedRect ellipse = cv::fitEllipse(contours[i]);
+        double MA = ellipse.size.width;
+        double ma = ellipse.size.height;
+        if (MA < MIN_AXIS || ma < MIN_AXIS || MA > MAX_AXIS || ma > MAX_AXIS)
+            continue;
+        double aspect_ratio = ma > 0 ? MA / ma : 1;
+        if (aspect_ratio < ASPECT_RATIO_MIN || aspect_ratio > ASPECT_RATIO_MAX)
+            continue;
+        candidates.push_back(i);
+        centres.push_back(ellipse.center);
+    }
+
+    // Merge close contours
+    std::vector<std::vector<cv::Point>> merged;
+    std::vector<bool> used(candidates.size(), false);
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (used[i])
+            continue;
+        std::vector<cv::Point> cnt = contours[candidates[i]];
+        for (size_t j = i + 1; j < candidates.size(); ++j) {
+            if (used[j])
+                continue;
+            double dist = std::hypot(centres[i].x - centres[j].x, centres[i].y - centres[j].y);
+            if (dist < MERGE_DISTANCE) {
+                used[j] = true;
+                const auto& other = contours[candidates[j]];
+                cnt.insert(cnt.end(), other.begin(), other.end());
+            }
+        }
+        used[i] = true;
+        merged.push_back(std::move(cnt));
+    }
+
+    // Classify by brightness against the background under the same mask
+    for (size_t i = 0; i < merged.size(); ++i) {
+        cv::Rect box = cv::boundingRect(merged[i]);
+
+        mask = cv::Mat::zeros(gray.rows, gray.cols, CV_8UC1);
+        cv::drawContours(mask, merged, static_cast<int>(i), cv::Scalar(255), -1);
+
+        cv::Mat cropped_mask = mask(box);
+        double object_avg = cv::mean(gray(box), cropped_mask)[0];
+        double background_avg = cv::mean(background(box), cropped_mask)[0];
+        double avg_diff = object_avg - background_avg;
+
+        Detection d;
+        if (avg_diff < BLACK_THRESHOLD)
+            d.color = CylinderColor::Black;
+        else if (avg_diff < GREY_THRESHOLD)
+            d.color = CylinderColor::Grey;
+        else
+            continue;
+
+        d.bbox = box;
+        d.x = box.x + box.width / 2;
+        d.y = box.y + box.height / 2;
+        out.push_back(d);
+    }
+    return true;
+}
@@ -0,0 +1,190 @@
+#include "pick_sequencer.hpp"
+#include "KSolver.hpp"
+#include "constants.hpp"
+#include "workspace_map.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+double jointTravelTime(double a0, double b0, double a1, double b1) {
+    using namespace Constants;
+    double motor_a = std::abs(a1 - a0);
+    double motor_b = std::abs((a1 + b1) - (a0 + b0));
+    return std::max(motor_a / J1_max_speed, motor_b / J2_max_speed);
+}
+
+namespace {
+
+// Points are numbered start, picks, then drops; cost[i][j] is the travel time
+struct CostTable {
+    size_t size;
+    std::vector<double> cost;
+    double operator()(size_t from, size_t to) const { return cost[from * size + to]; }
+};
+
+CostTable buildCosts(double from_x, double from_y, const std::vector<PickPoint>& picks,
+                     const std::vector<PickPoint>& drops, std::vector<uint8_t>& reachable,
+                     std::vector<double>& as, std::vector<double>& bs) {
+    const size_t n = 1 + picks.size() + drops.size();
+    std::vector<double> xs(n), ys(n);
+    as.resize(n);
+    bs.resize(n);
+    xs[0] = from_x;
+    ys[0] = from_y;
+    for (size_t i = 0; i < picks.size(); ++i) {
+        xs[1 + i] = picks[i].x;
+        ys[1 + i] = picks[i].y;
+    }
+    for (size_t i = 0; i < drops.size(); ++i) {
+        xs[1 + picks.size() + i] = drops[i].x;
+        ys[1 + picks.size() + i] = drops[i].y;
+    }
+
+    reachable.resize(n);
+    ArmKSolver::calculateIK(xs.data(), ys.data(), n, as.data(), bs.data(), reachable.data());
+    for (size_t i = 1; i < n; ++i)
+        reachable[i] = workspaceMap().reachable(xs[i], ys[i]);
+    reachable[0] = 1;   // Wherever the arm is, it can leave
+
+    CostTable table{n, std::vector<double>(n * n)};
+    for (size_t i = 0; i < n; ++i)
+        for (size_t j = 0; j < n; ++j)
+            table.cost[i * n + j] = jointTravelTime(as[i], bs[i], as[j], bs[j]);
+    return table;
+}
+
+bool fits(const PickPoint& pick, const PickPoint& drop) {
+    return pick.color < 0 || drop.color < 0 || pick.color == drop.color;
+}
+
+// Dynamic programming over (picks done, slots used, last slot). Every pick
+// that can be placed is placed; among those plans the fastest wins.
+void planExact(const CostTable& cost, const std::vector<int>& picks, const std::vector<int>& drops,
+               const std::vector<PickPoint>& pick_points, const std::vector<PickPoint>& drop_points,
+               PickPlan& plan) {
+    const int n = static_cast<int>(picks.size());
+    const int m = static_cast<int>(drops.size());
+    const size_t pick_states = size_t(1) << n, drop_states = size_t(1) << m;
+    const size_t states = pick_states * drop_states * (m + 1);    // last == m: still at the start
+    auto at = [&](size_t pm, size_t dm, int last) { return (pm * drop_states + dm) * (m + 1) + last; };
+
+    constexpr double inf = std::numeric_limits<double>::infinity();
+    std::vector<double> best(states, inf);
+    std::vector<int32_t> parent(states, -1);
+    std::vector<int8_t> via_pick(states, -1), via_drop(states, -1);
+    const size_t start_point = 0;
+    const size_t pick_base = 1, drop_base = 1 + pick_points.size();
+    auto pointOf = [&](int last) { return last == m ? start_point : drop_base + drops[last]; };
+
+    best[at(0, 0, m)] = 0.0;
+    size_t goal = at(0, 0, m);
+    int goal_pairs = 0;
+    for (size_t pm = 0; pm < pick_states; ++pm) {
+        for (size_t dm = 0; dm < drop_states; ++dm) {
+            for (int last = 0; last <= m; ++last) {
+                size_t s = at(pm, dm, last);
+                if (best[s] == inf)
+                    continue;
+                int pairs = __builtin_popcountll(pm);
+                if (pairs > goal_pairs || (pairs == goal_pairs && best[s] < best[goal])) {
+                    goal = s;
+                    goal_pairs = pairs;
+                }
+                for (int i = 0; i < n; ++i) {
+                    if (pm & (size_t(1) << i))
+                        continue;
+                    double to_pick = best[s] + cost(pointOf(last), pick_base + picks[i]);
+                    for (int k = 0; k < m; ++k) {
+                        if ((dm & (size_t(1) << k)) || !fits(pick_points[picks[i]], drop_points[drops[k]]))
+                            continue;
+                        size_t next = at(pm | (size_t(1) << i), dm | (size_t(1) << k), k);
+                        double total = to_pick + cost(pick_base + picks[i], drop_base + drops[k]);
+                        if (total < best[next]) {
+                            best[next] = total;
+                            parent[next] = static_cast<int32_t>(s);
+                            via_pick[next] = static_cast<int8_t>(i);
+                            via_drop[next] = static_cast<int8_t>(k);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    plan.travel_time = best[goal];
+    for (size_t s = goal; parent[s] >= 0; s = static_cast<size_t>(parent[s]))
+        plan.pairs.emplace_back(picks[via_pick[s]], drops[via_drop[s]]);
+    std::reverse(plan.pairs.begin(), plan.pairs.end());
+}
+
+// Nearest pick then nearest free slot, for tables too big to search
+void planGreedy(const CostTable& cost, std::vector<int> picks, std::vector<int> drops,
+                const std::vector<PickPoint>& pick_points, const std::vector<PickPoint>& drop_points,
+                PickPlan& plan) {
+    const size_t pick_base = 1, drop_base = 1 + pick_points.size();
+    size_t at = 0;
+    while (!picks.empty()) {
+        double best = std::numeric_limits<double>::infinity();
+        size_t best_i = 0, best_k = 0;
+        for (size_t i = 0; i < picks.size(); ++i) {
+            for (size_t k = 0; k < drops.size(); ++k) {
+                if (!fits(pick_points[picks[i]], drop_points[drops[k]]))
+                    continue;
+                double t = cost(at, pick_base + picks[i]) + cost(pick_base + picks[i], drop_base + drops[k]);
+                if (t < best) {
+                    best = t;
+                    best_i = i;
+                    best_k = k;
+                }
+            }
+        }
+        if (best == std::numeric_limits<double>::infinity())
+            break;  // No slot left for any remaining pick
+        plan.pairs.emplace_back(picks[best_i], drops[best_k]);
+        plan.travel_time += best;
+        at = drop_base + drops[best_k];
+        picks.erase(picks.begin() + best_i);
+        drops.erase(drops.begin() + best_k);
+    }
+}
+
+} // namespace
+
+void planPickSequence(double from_x, double from_y,
+                      const std::vector<PickPoint>& picks, const std::vector<PickPoint>& drops,
+                      PickPlan& plan) {
+    plan = PickPlan();
+    std::vector<uint8_t> reachable;
+    std::vector<double> as, bs;
+    CostTable cost = buildCosts(from_x, from_y, picks, drops, reachable, as, bs);
+    for (size_t i = 0; i < picks.size(); ++i)
+        plan.pick_angles.emplace_back(as[1 + i], bs[1 + i]);
+    for (size_t i = 0; i < drops.size(); ++i)
+        plan.drop_angles.emplace_back(as[1 + picks.size() + i], bs[1 + picks.size() + i]);
+
+    std::vector<int> pick_ids, drop_ids;
+    for (size_t i = 0; i < picks.size(); ++i) {
+        if (reachable[1 + i])
+            pick_ids.push_back(static_cast<int>(i));
+    }
+    for (size_t i = 0; i < drops.size(); ++i) {
+        if (reachable[1 + picks.size() + i])
+            drop_ids.push_back(static_cast<int>(i));
+    }
+
+    if (static_cast<int>(pick_ids.size()) <= Constants::batch_exact_limit &&
+        static_cast<int>(drop_ids.size()) <= Constants::batch_exact_limit)
+        planExact(cost, pick_ids, drop_ids, picks, drops, plan);
+    else
+        planGreedy(cost, pick_ids, drop_ids, picks, drops, plan);
+
+    std::vector<uint8_t> placed(picks.size(), 0);
+    for (const auto& pair : plan.pairs)
+        placed[pair.first] = 1;
+    for (size_t i = 0; i < picks.size(); ++i) {
+        if (!placed[i])
+            plan.skipped.push_back(static_cast<int>(i));
+    }
+}
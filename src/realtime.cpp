@@ -0,0 +1,77 @@
+#include "realtime.hpp"
+#include "logger.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <alloca.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static bool validCpu(int cpu) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu < 0 || cpu >= cpus || cpu >= CPU_SETSIZE) {
+        logWarn("CPU {} does not exist, not pinning.", cpu);
+        return false;
+    }
+    return true;
+}
+
+bool avoidCpu(int cpu) {
+    if (!validCpu(cpu))
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0 || CPU_COUNT(&set) < 2) {
+        logWarn("Not enough CPUs to reserve one for the motor thread.");
+        return false;
+    }
+    CPU_CLR(cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0) {
+        logWarn("Could not move threads off CPU {}: {}", cpu, std::strerror(err));
+        return false;
+    }
+    return true;
+}
+
+bool makeThreadRealtime(int priority, int cpu) {
+    bool ok = true;
+    if (validCpu(cpu)) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            logWarn("Could not pin to CPU {}: {}", cpu, std::strerror(err));
+            ok = false;
+        }
+    } else {
+        ok = false;
+    }
+
+    sched_param param{};
+    param.sched_priority = priority;
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err != 0) {
+        logWarn("SCHED_FIFO {} refused: {}", priority, std::strerror(err));
+        ok = false;
+    }
+    return ok;
+}
+
+bool lockMemory() {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        logWarn("mlockall failed: {}", std::strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void prefaultStack(size_t bytes) {
+    // volatile so the writes aren't optimised away
+    volatile unsigned char* stack = static_cast<unsigned char*>(alloca(bytes));
+    for (size_t i = 0; i < bytes; i += 4096)
+        stack[i] = 0;
+}
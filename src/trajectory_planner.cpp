@@ -0,0 +1,274 @@
+#include "trajectory_planner.hpp"
+#include "KSolver.hpp"
+#include "constants.hpp"
+#include "motor_control.hpp"
+#include "workspace_map.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+TrajectoryPlanner::TrajectoryPlanner(double max_speed, double max_accel, double dt)
+    : max_speed(max_speed), max_accel(max_accel), dt(dt) {}
+
+namespace {
+
+struct Box {
+    double left, right, bottom, top;    // left < right, bottom < top
+};
+
+Box deadzoneBox() {
+    using namespace Constants;
+    return {std::min(deadzone_x_left, deadzone_x_right) - deadzone_margin,
+            std::max(deadzone_x_left, deadzone_x_right) + deadzone_margin,
+            std::min(deadzone_y_top, deadzone_y_bottom) - deadzone_margin,
+            std::max(deadzone_y_top, deadzone_y_bottom) + deadzone_margin};
+}
+
+bool strictlyInside(const Box& box, double x, double y) {
+    constexpr double eps = 1e-9;
+    return x > box.left + eps && x < box.right - eps && y > box.bottom + eps && y < box.top - eps;
+}
+
+// A straight segment the gripper can follow: every sample reachable on the
+// workspace map, J1 never wrapping around behind the base, and clear of the
+// margin around the deadzone unless one end already sits in it
+bool segmentClear(const Box& box, double x0, double y0, double x1, double y1) {
+    const WorkspaceMap& map = workspaceMap();
+    // Both ends on the map bounds the sample count below
+    if (!map.reachable(x0, y0) || !map.reachable(x1, y1))
+        return false;
+    const bool keep_margin = !strictlyInside(box, x0, y0) && !strictlyInside(box, x1, y1);
+    const int n = std::max(1, static_cast<int>(std::ceil(std::hypot(x1 - x0, y1 - y0) / map.cellSize())));
+    double previous_a = 0.0;
+    for (int i = 0; i <= n; ++i) {
+        double t = static_cast<double>(i) / n;
+        double x = x0 + (x1 - x0) * t, y = y0 + (y1 - y0) * t;
+        if (!map.reachable(x, y) || (keep_margin && strictlyInside(box, x, y)))
+            return false;
+        double a = 0.0, b = 0.0;
+        map.seed(x, y, a, b);
+        if (i > 0 && std::abs(a - previous_a) > 90.0)
+            return false;
+        previous_a = a;
+    }
+    return true;
+}
+
+// Detour waypoints on rings around the base, kept where the arm can go, and
+// the length of the clear segment between every two of them
+struct DetourGraph {
+    std::vector<double> x, y;
+    std::vector<double> cost;   // n * n, INFINITY where the segment isn't clear
+};
+
+const DetourGraph& detourGraph() {
+    static const DetourGraph graph = [] {
+        using namespace Constants;
+        const Box box = deadzoneBox();
+        const double reach = L1 + std::hypot(L2, offset);
+        DetourGraph g;
+        for (double r = 3 * detour_spacing; r <= reach - detour_spacing; r += detour_spacing) {
+            int count = static_cast<int>(std::ceil(2 * PI * r / detour_spacing));
+            for (int i = 0; i < count; ++i) {
+                double x = r * std::sin(2 * PI * i / count), y = r * std::cos(2 * PI * i / count);
+                if (workspaceMap().reachable(x, y) && !strictlyInside(box, x, y)) {
+                    g.x.push_back(x);
+                    g.y.push_back(y);
+                }
+            }
+        }
+        const size_t n = g.x.size();
+        g.cost.assign(n * n, INFINITY);
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = i + 1; j < n; ++j) {
+                if (segmentClear(box, g.x[i], g.y[i], g.x[j], g.y[j]))
+                    g.cost[i * n + j] = g.cost[j * n + i] = std::hypot(g.x[j] - g.x[i], g.y[j] - g.y[i]);
+            }
+        }
+        return g;
+    }();
+    return graph;
+}
+
+} // namespace
+
+size_t TrajectoryPlanner::prepareDetours() {
+    return detourGraph().x.size();
+}
+
+int TrajectoryPlanner::checkDetours() {
+    using namespace Constants;
+    TrajectoryPlanner planner(trajectory_max_speed, trajectory_max_accel, control_loop_ms / 1000.0);
+    std::vector<Setpoint> out;
+    constexpr double radius = 15.0;
+    int failed = 0;
+    for (int degrees = 0; degrees < 180; degrees += 15) {
+        double angle = degrees * PI / 180.0;
+        double x = radius * std::sin(angle), y = radius * std::cos(angle);
+        if (!workspaceMap().reachable(x, y) || !workspaceMap().reachable(-x, -y))
+            continue;
+        if (!planner.plan(x, y, -x, -y, out) || !planner.plan(-x, -y, x, y, out))
+            ++failed;
+    }
+    return failed;
+}
+
+void TrajectoryPlanner::route(double from_x, double from_y, double to_x, double to_y, std::vector<double>& xs, std::vector<double>& ys) {
+    const Box box = deadzoneBox();
+    xs = {from_x};
+    ys = {from_y};
+
+    // Straight there if nothing is in the way; if no detour helps either,
+    // the straight line is left for plan() to reject
+    auto direct = [&]() {
+        xs.push_back(to_x);
+        ys.push_back(to_y);
+    };
+    if (segmentClear(box, from_x, from_y, to_x, to_y))
+        return direct();
+
+    // Shortest path through the waypoints, Dijkstra over the dense graph;
+    // node n is the start and n + 1 the target
+    const DetourGraph& g = detourGraph();
+    const size_t n = g.x.size();
+    // The start and target edges are the only ones not in the graph; each is
+    // checked once here, not on every relaxation
+    std::vector<double> from_cost(n), to_cost(n);
+    for (size_t i = 0; i < n; ++i) {
+        from_cost[i] = segmentClear(box, from_x, from_y, g.x[i], g.y[i])
+                           ? std::hypot(g.x[i] - from_x, g.y[i] - from_y) : INFINITY;
+        to_cost[i] = segmentClear(box, g.x[i], g.y[i], to_x, to_y)
+                         ? std::hypot(to_x - g.x[i], to_y - g.y[i]) : INFINITY;
+    }
+    auto cost = [&](size_t i, size_t j) {
+        if (i == n)
+            return j < n ? from_cost[j] : INFINITY;   // start -> target is known blocked
+        return j < n ? g.cost[i * n + j] : to_cost[i];
+    };
+    std::vector<double> distance(n + 2, INFINITY);
+    std::vector<size_t> previous(n + 2, n + 2);
+    std::vector<uint8_t> done(n + 2, 0);
+    distance[n] = 0.0;
+    while (true) {
+        size_t best = n + 2;
+        for (size_t i = 0; i < n + 2; ++i) {
+            if (!done[i] && distance[i] < INFINITY && (best == n + 2 || distance[i] < distance[best]))
+                best = i;
+        }
+        if (best == n + 2)
+            return direct();
+        if (best == n + 1)
+            break;
+        done[best] = 1;
+        for (size_t next = 0; next < n + 2; ++next) {
+            if (done[next] || next == n)
+                continue;
+            double d = distance[best] + cost(best, next);
+            if (d < distance[next]) {
+                distance[next] = d;
+                previous[next] = best;
+            }
+        }
+    }
+
+    std::vector<size_t> path;
+    for (size_t i = previous[n + 1]; i != n; i = previous[i])
+        path.push_back(i);
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        xs.push_back(g.x[*it]);
+        ys.push_back(g.y[*it]);
+    }
+    direct();
+}
+
+bool TrajectoryPlanner::sample(const std::vector<double>& xs, const std::vector<double>& ys, double speed, double accel, std::vector<Setpoint>& out) {
+    using namespace Constants;
+    out.clear();
+    sample_x.clear();
+    sample_y.clear();
+    sample_t.clear();
+
+    auto push = [&](double t, double x, double y) {
+        sample_t.push_back(t);
+        sample_x.push_back(x);
+        sample_y.push_back(y);
+    };
+
+    // The gripper stops at every corner, each segment gets its own trapezoid
+    double start = 0.0;
+    double next_sample = 0.0;
+    for (size_t i = 0; i + 1 < xs.size(); ++i) {
+        double dx = xs[i + 1] - xs[i], dy = ys[i + 1] - ys[i];
+        double distance = std::hypot(dx, dy);
+        if (distance < 1e-6) continue;
+
+        double peak = std::min(speed, std::sqrt(distance * accel));
+        double ramp = peak / accel;                             // Time to reach peak speed
+        double cruise = (distance - peak * ramp) / peak;        // Time at peak speed
+        double total = 2 * ramp + cruise;
+
+        for (; next_sample < start + total; next_sample += dt) {
+            double t = next_sample - start;
+            double s;
+            if (t < ramp) {
+                s = 0.5 * accel * t * t;
+            } else if (t < ramp + cruise) {
+                s = 0.5 * peak * ramp + peak * (t - ramp);
+            } else {
+                double left = total - t;
+                s = distance - 0.5 * accel * left * left;
+            }
+            push(next_sample, xs[i] + dx * s / distance, ys[i] + dy * s / distance);
+        }
+        start += total;
+    }
+    push(start, xs.back(), ys.back());
+
+    // IK for the whole path in one pass
+    const size_t n = sample_t.size();
+    sample_a.resize(n);
+    sample_b.resize(n);
+    sample_ok.resize(n);
+    ArmKSolver::calculateIK(sample_x.data(), sample_y.data(), n, sample_a.data(), sample_b.data(), sample_ok.data());
+
+    out.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        bool reachable = sample_ok[i];
+        double a = clampAngle(sample_a[i], J1_limit, reachable);
+        double b = clampAngle(sample_b[i], J2_limit, reachable);
+        if (!reachable)
+            return false;
+        out.push_back({sample_t[i], sample_x[i], sample_y[i], a, b});
+    }
+    return true;
+}
+
+bool TrajectoryPlanner::plan(double from_x, double from_y, double to_x, double to_y, std::vector<Setpoint>& out) {
+    using namespace Constants;
+    std::vector<double> xs, ys;
+    route(from_x, from_y, to_x, to_y, xs, ys);
+
+    double speed = max_speed;
+    double accel = max_accel;
+    for (int attempt = 0; attempt < 4; ++attempt) {
+        if (!sample(xs, ys, speed, accel, out))
+            return false;
+
+        // Motor B turns with joint A plus joint B, like on the EV3
+        double worst = 0.0;
+        for (size_t i = 1; i < out.size(); ++i) {
+            double step = std::max(out[i].t - out[i - 1].t, 1e-6);
+            double rate_a = std::abs(out[i].a - out[i - 1].a) / step;
+            double rate_b = std::abs((out[i].a + out[i].b) - (out[i - 1].a + out[i - 1].b)) / step;
+            worst = std::max({worst, rate_a / J1_max_speed, rate_b / J2_max_speed});
+        }
+        if (worst <= 1.0)
+            return true;
+
+        // Running the same path r times slower divides speed by r and acceleration by r^2
+        double r = worst * 1.05;
+        speed /= r;
+        accel /= r * r;
+    }
+    return false;   // Passes too close to a singularity or wraps around the back
+}
@@ -0,0 +1,203 @@
+#include "v4l2_capture.hpp"
+#include <linux/videodev2.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+// ioctl() that retries when interrupted by a signal
+static int xioctl(int fd, unsigned long request, void* arg) {
+    int r;
+    do {
+        r = ioctl(fd, request, arg);
+    } while (r == -1 && errno == EINTR);
+    return r;
+}
+
+V4L2Capture::~V4L2Capture() {
+    close();
+}
+
+bool V4L2Capture::open(const char* device, int width, int height, int fps, uint32_t fourcc, int queue_depth) {
+    close();
+
+    fd = ::open(device, O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        std::cerr << "[v4l2] Cannot open " << device << ": " << strerror(errno) << "\n";
+        return false;
+    }
+
+    v4l2_capability cap{};
+    if (xioctl(fd, VIDIOC_QUERYCAP, &cap) < 0 ||
+        !(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+        !(cap.capabilities & V4L2_CAP_STREAMING)) {
+        std::cerr << "[v4l2] " << device << " is not a streaming capture device\n";
+        close();
+        return false;
+    }
+
+    // Pixel format and size; the driver may pick the nearest it supports
+    v4l2_format fmt{};
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.width = width;
+    fmt.fmt.pix.height = height;
+    fmt.fmt.pix.pixelformat = fourcc;
+    fmt.fmt.pix.field = V4L2_FIELD_NONE;
+    if (xioctl(fd, VIDIOC_S_FMT, &fmt) < 0) {
+        std::cerr << "[v4l2] VIDIOC_S_FMT failed: " << strerror(errno) << "\n";
+        close();
+        return false;
+    }
+    frame_width = fmt.fmt.pix.width;
+    frame_height = fmt.fmt.pix.height;
+    pixel_format = fmt.fmt.pix.pixelformat;
+
+    // Frame rate is best effort, not every driver supports it
+    v4l2_streamparm parm{};
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    parm.parm.capture.timeperframe.numerator = 1;
+    parm.parm.capture.timeperframe.denominator = fps;
+    xioctl(fd, VIDIOC_S_PARM, &parm);
+
+    v4l2_requestbuffers req{};
+    req.count = std::clamp(queue_depth, 1, 4);
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 1) {
+        std::cerr << "[v4l2] VIDIOC_REQBUFS failed: " << strerror(errno) << "\n";
+        close();
+        return false;
+    }
+
+    buffers.resize(req.count);
+    for (unsigned i = 0; i < req.count; ++i) {
+        v4l2_buffer buf{};
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (xioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) {
+            std::cerr << "[v4l2] VIDIOC_QUERYBUF failed: " << strerror(errno) << "\n";
+            close();
+            return false;
+        }
+        void* start = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+        if (start == MAP_FAILED) {
+            std::cerr << "[v4l2] mmap failed: " << strerror(errno) << "\n";
+            close();
+            return false;
+        }
+        buffers[i].start = start;
+        buffers[i].length = buf.length;
+        if (!queueBuffer(i)) {
+            close();
+            return false;
+        }
+    }
+
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(fd, VIDIOC_STREAMON, &type) < 0) {
+        std::cerr << "[v4l2] VIDIOC_STREAMON failed: " << strerror(errno) << "\n";
+        close();
+        return false;
+    }
+    return true;
+}
+
+void V4L2Capture::close() {
+    if (fd < 0)
+        return;
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    xioctl(fd, VIDIOC_STREAMOFF, &type);
+    for (Buffer& b : buffers) {
+        if (b.start)
+            munmap(b.start, b.length);
+    }
+    buffers.clear();
+    ::close(fd);
+    fd = -1;
+}
+
+bool V4L2Capture::queueBuffer(int index) {
+    v4l2_buffer buf{};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if (xioctl(fd, VIDIOC_QBUF, &buf) < 0) {
+        std::cerr << "[v4l2] VIDIOC_QBUF failed: " << strerror(errno) << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool V4L2Capture::grab(V4L2Frame& frame, int timeout_ms) {
+    if (fd < 0)
+        return false;
+
+    pollfd pfd{fd, POLLIN, 0};
+    int r = poll(&pfd, 1, timeout_ms);
+    if (r <= 0)
+        return false;   // Timeout or error
+
+    // Drain everything that is ready and keep only the newest buffer
+    v4l2_buffer newest{};
+    bool have = false;
+    while (true) {
+        v4l2_buffer buf{};
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        if (xioctl(fd, VIDIOC_DQBUF, &buf) < 0) {
+            if (errno != EAGAIN)
+                std::cerr << "[v4l2] VIDIOC_DQBUF failed: " << strerror(errno) << "\n";
+            break;
+        }
+        if (have)
+            queueBuffer(newest.index);
+        newest = buf;
+        have = true;
+    }
+    if (!have)
+        return false;
+
+    if (newest.flags & V4L2_BUF_FLAG_ERROR) {
+        queueBuffer(newest.index);
+        return false;
+    }
+
+    frame.data = static_cast<const unsigned char*>(buffers[newest.index].start);
+    frame.size = newest.bytesused;
+    frame.sequence = newest.sequence;
+    frame.index = newest.index;
+
+    // MONOTONIC buffer timestamps share their clock with steady_clock on Linux
+    if ((newest.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+        auto ts = std::chrono::seconds(newest.timestamp.tv_sec) +
+                  std::chrono::microseconds(newest.timestamp.tv_usec);
+        frame.timestamp = std::chrono::steady_clock::time_point(
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(ts));
+    } else {
+        frame.timestamp = std::chrono::steady_clock::now();
+    }
+    return true;
+}
+
+void V4L2Capture::release(const V4L2Frame& frame) {
+    if (fd >= 0 && frame.index >= 0)
+        queueBuffer(frame.index);
+}
+
+bool V4L2Capture::setControl(uint32_t id, int32_t value) {
+    v4l2_control ctrl{};
+    ctrl.id = id;
+    ctrl.value = value;
+    if (xioctl(fd, VIDIOC_S_CTRL, &ctrl) < 0) {
+        std::cerr << "[v4l2] Could not set control 0x" << std::hex << id << std::dec
+                  << ": " << strerror(errno) << "\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,138 @@
+#include "workspace_map.hpp"
+#include "KSolver.hpp"
+#include "constants.hpp"
+#include "motor_control.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+uint8_t WorkspaceMap::classify(double x, double y, double& a, double& b) {
+    using namespace Constants;
+    static KSolver solver(L1, L2, offset);     // calculateIK only reads it, safe to share
+
+    uint8_t flags = 0;
+    double left = std::min(deadzone_x_left, deadzone_x_right), right = std::max(deadzone_x_left, deadzone_x_right);
+    double bottom = std::min(deadzone_y_top, deadzone_y_bottom), top = std::max(deadzone_y_top, deadzone_y_bottom);
+    if (x > left && x < right && y > bottom && y < top)
+        flags |= Deadzone;
+
+    if (!solver.calculateIK(x, y, a, b))
+        flags |= OutOfReach;
+    a = a * 180.0 / PI;
+    b = b * 180.0 / PI;
+    bool within = true;
+    a = clampAngle(a, J1_limit, within);
+    b = clampAngle(b, J2_limit, within);
+    if (!within)
+        flags |= JointLimit;
+
+    if (flags == 0)
+        flags = Reachable;
+    return flags;
+}
+
+WorkspaceMap::WorkspaceMap(double cell_cm) : cell(cell_cm) {
+    using namespace Constants;
+    const double reach = L1 + std::sqrt(L2 * L2 + offset * offset);
+    grid_cols = grid_rows = static_cast<int>(std::ceil(2 * reach / cell));
+    min_x = min_y = -grid_cols * cell / 2;
+
+    // Classify every grid corner once, cells then look at their four corners.
+    // Close to a joint limit the reachable set can be thinner than a cell
+    // (J1 wraps at its limit behind the base), so such corners never settle
+    // a cell on their own.
+    constexpr double limit_margin = 5.0;   // degrees
+    const int corner_cols = grid_cols + 1;
+    std::vector<uint8_t> corner_ok(static_cast<size_t>(corner_cols) * (grid_rows + 1));
+    std::vector<uint8_t> corner_near(corner_ok.size());
+    std::vector<double> xs(corner_cols), ys(corner_cols), as(corner_cols), bs(corner_cols);
+    std::vector<uint8_t> in_reach(corner_cols);
+    const double dz_left = std::min(deadzone_x_left, deadzone_x_right), dz_right = std::max(deadzone_x_left, deadzone_x_right);
+    const double dz_bottom = std::min(deadzone_y_top, deadzone_y_bottom), dz_top = std::max(deadzone_y_top, deadzone_y_bottom);
+    for (int r = 0; r <= grid_rows; ++r) {
+        // One batch IK call per row of corners
+        for (int c = 0; c <= grid_cols; ++c) {
+            xs[c] = min_x + c * cell;
+            ys[c] = min_y + r * cell;
+        }
+        ArmKSolver::calculateIK(xs.data(), ys.data(), corner_cols, as.data(), bs.data(), in_reach.data());
+        for (int c = 0; c <= grid_cols; ++c) {
+            bool in_deadzone = xs[c] > dz_left && xs[c] < dz_right && ys[c] > dz_bottom && ys[c] < dz_top;
+            bool in_limits = std::abs(as[c]) <= J1_limit && std::abs(bs[c]) <= J2_limit;
+            corner_ok[r * corner_cols + c] = in_reach[c] && in_limits && !in_deadzone;
+            corner_near[r * corner_cols + c] = std::abs(as[c]) > J1_limit - limit_margin || std::abs(bs[c]) > J2_limit - limit_margin;
+        }
+    }
+    double a, b;
+
+    cell_flags.resize(static_cast<size_t>(grid_cols) * grid_rows);
+    seeds.resize(cell_flags.size() * 2);
+    for (int r = 0; r < grid_rows; ++r) {
+        for (int c = 0; c < grid_cols; ++c) {
+            const int k[4] = {r * corner_cols + c, r * corner_cols + c + 1,
+                              (r + 1) * corner_cols + c, (r + 1) * corner_cols + c + 1};
+            int ok = 0;
+            bool near_limit = false;
+            for (int corner : k) {
+                ok += corner_ok[corner];
+                near_limit = near_limit || corner_near[corner];
+            }
+            size_t i = static_cast<size_t>(r) * grid_cols + c;
+            uint8_t center = classify(min_x + (c + 0.5) * cell, min_y + (r + 0.5) * cell, a, b);
+            seeds[2 * i] = static_cast<float>(a);
+            seeds[2 * i + 1] = static_cast<float>(b);
+
+            // The deadzone is an axis aligned box, so four corners settle it;
+            // the reach and limit edges are curves and could cut a corner, so
+            // a cell whose center disagrees with its corners is a boundary too
+            if (near_limit)
+                cell_flags[i] = Boundary | (center & ~Reachable);
+            else if (ok == 4 && center == Reachable)
+                cell_flags[i] = Reachable;
+            else if (ok == 0 && center != Reachable)
+                cell_flags[i] = center;
+            else
+                cell_flags[i] = Boundary | (center & ~Reachable);
+        }
+    }
+}
+
+int WorkspaceMap::index(double x, double y) const {
+    // Bound in double first: coordinates come straight from clients, and an
+    // out of range or NaN double->int conversion is undefined
+    double fc = std::floor((x - min_x) / cell);
+    double fr = std::floor((y - min_y) / cell);
+    if (!(fc >= 0 && fr >= 0 && fc < grid_cols && fr < grid_rows))
+        return -1;
+    return static_cast<int>(fr) * grid_cols + static_cast<int>(fc);
+}
+
+uint8_t WorkspaceMap::flags(double x, double y) const {
+    int i = index(x, y);
+    return i < 0 ? 0 : cell_flags[i];
+}
+
+bool WorkspaceMap::reachable(double x, double y) const {
+    int i = index(x, y);
+    if (i < 0)
+        return false;   // The grid covers the whole reach
+    if (cell_flags[i] & Boundary) {
+        double a, b;
+        return classify(x, y, a, b) == Reachable;
+    }
+    return cell_flags[i] == Reachable;
+}
+
+bool WorkspaceMap::seed(double x, double y, double& a, double& b) const {
+    int i = index(x, y);
+    if (i < 0)
+        return false;
+    a = seeds[2 * i];
+    b = seeds[2 * i + 1];
+    return true;
+}
+
+const WorkspaceMap& workspaceMap() {
+    static const WorkspaceMap map(Constants::workspace_cell);
+    return map;
+}
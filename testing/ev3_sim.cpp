@@ -0,0 +1,622 @@
+// File: ev3_sim.cpp
+//
+// Stand-in for ev3/motor_control.py, so the Pi side can run without the robot.
+// Speaks the same protocol (RDY handshake, sequenced text or binary commands,
+// SP/VEL streaming, STOP, SHUTDOWN) and moves a simulated arm at the joint
+// speeds of the real motors, with optional network delay and failures.
+//
+// Build : cmake target ev3_sim, or
+//         g++ -std=c++17 -O2 -Iinclude testing/ev3_sim.cpp src/ev3_frame.cpp src/event_loop.cpp src/logger.cpp -pthread -o ev3_sim
+//
+// Run   : ./ev3_sim --latency 5 --jitter 3 --fail 0.01
+//         ./Raspberry2025 --ev3 localhost:1234
+
+#include "constants.hpp"
+#include "ev3_frame.hpp"
+#include "event_loop.hpp"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+    int port = Constants::PORT;
+    double speed_a = Constants::J1_max_speed;   // deg/s of motor A
+    double speed_b = Constants::J2_max_speed;   // deg/s of motor B, which turns with A + B
+    double settle = 0.2;                        // s after every MOTOR, like lerp_both_motors
+    double grab_time = 1.0;                     // s per GRABBER step
+    double latency = 0.0;                       // s, each way
+    double jitter = 0.0;                        // s, added to latency, uniform
+    double fail = 0.0;                          // Chance a command ends with an error
+    double drop = 0.0;                          // Chance a command is never acked
+    long disconnect_after = 0;                  // Commands, then the connection is cut; 0 never
+    bool legacy = false;                        // Plain "RDY", one command at a time, bare "OK"
+    bool once = false;                          // Exit after the first connection
+    unsigned seed = 1;
+};
+
+struct Stats {
+    uint64_t commands = 0, steps = 0, ok = 0, failed = 0, dropped = 0, stopped = 0;
+    uint64_t setpoints = 0, velocities = 0, bad_frames = 0;
+};
+
+// One command as queued by the EV3 script; error is set if it didn't parse
+struct Command {
+    std::string seq;
+    std::vector<Ev3Step> steps;
+    std::string error;
+};
+
+// Something the Pi sent, applied once the simulated network delay has passed
+struct Incoming {
+    enum Kind { Run, Stop, Shutdown, Stream } kind = Run;
+    double due = 0.0;
+    Command command;
+    Ev3Step step;       // Setpoint or Velocity
+};
+
+struct Outgoing {
+    double due = 0.0;
+    std::string line;
+};
+
+double now() {
+    return std::chrono::duration<double>(clock_type::now().time_since_epoch()).count();
+}
+
+double smoothLerp(double progress) {
+    return progress * progress * (3.0 - 2.0 * progress);
+}
+
+int32_t getI32(const uint8_t* p) {
+    return static_cast<int32_t>(p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24);
+}
+
+// "MOTOR a b" / "GRABBER on|off", like parse_step in the EV3 script
+bool parseTextStep(const std::string& text, Ev3Step& step) {
+    std::istringstream in(text);
+    std::string word, state;
+    in >> word;
+    if (word == "MOTOR") {
+        step.op = Ev3Op::Motor;
+        return static_cast<bool>(in >> step.a >> step.b);
+    }
+    if (word == "GRABBER" && in >> state && (state == "on" || state == "off")) {
+        step.op = Ev3Op::Grabber;
+        step.grab = state == "on";
+        return true;
+    }
+    return false;
+}
+
+// Payload of one MOTOR or GRABBER step; returns the bytes used, 0 if malformed
+size_t decodeStep(Ev3Op op, const uint8_t* p, size_t size, Ev3Step& step) {
+    step.op = op;
+    if (op == Ev3Op::Motor && size >= 8) {
+        step.a = getI32(p) / 1000.0;
+        step.b = getI32(p + 4) / 1000.0;
+        return 8;
+    }
+    if (op == Ev3Op::Grabber && size >= 1) {
+        step.grab = p[0] != 0;
+        return 1;
+    }
+    return 0;
+}
+
+class Simulator {
+public:
+    Simulator(EventLoop& loop, const Options& options)
+        : loop(loop), options(options), random(options.seed) {}
+
+    // Takes over a freshly accepted connection
+    void start(int fd) {
+        client = fd;
+        input.clear();
+        incoming.clear();
+        outgoing.clear();
+        queue.clear();
+        running = false;
+        stream_fresh = false;
+        handshake = true;
+        binary = false;
+        legacy = false;
+        completed = 0;
+        last_tick = now();
+        last_due = 0.0;
+        loop.add(client, EPOLLIN, [this](uint32_t) { readable(); });
+        tick_timer = loop.addTimer(std::chrono::milliseconds(5), [this](uint64_t) { tick(); });
+
+        sendNow("Motor Control Starting");
+        sendNow("Resetting grabber");
+        sendNow(options.legacy ? "RDY" : "RDY SEQ BIN1 SP VEL");
+    }
+
+    bool connected() const { return client >= 0; }
+
+    void close(const char* why) {
+        if (client < 0)
+            return;
+        loop.cancelTimer(tick_timer);
+        loop.remove(client);
+        ::close(client);
+        client = -1;
+        std::cout << "Connection closed (" << why << ")\n";
+        printStats();
+        if (options.once)
+            loop.stop();
+    }
+
+    void printStats() const {
+        std::cout << "  commands " << stats.commands << " (" << stats.steps << " steps), ok " << stats.ok
+                  << ", failed " << stats.failed << ", dropped " << stats.dropped << ", stopped " << stats.stopped
+                  << "\n  setpoints " << stats.setpoints << ", velocities " << stats.velocities
+                  << ", bad frames " << stats.bad_frames << "\n"
+                  << "  arm at A " << arm_a << " deg, B " << (arm_b - arm_a) << " deg\n";
+    }
+
+private:
+    EventLoop& loop;
+    const Options& options;
+    std::mt19937 random;
+    Stats stats;
+
+    int client = -1;
+    int tick_timer = -1;
+    std::string input;
+    bool handshake = true;      // Waiting for the PROTO line
+    bool binary = false;
+    bool legacy = false;        // No PROTO line, one command at a time
+    long completed = 0;
+    double last_tick = 0.0;
+    std::deque<Incoming> incoming;
+    std::deque<Outgoing> outgoing;
+    double last_due = 0.0;      // Keeps delayed lines in order, like TCP would
+
+    // Motor positions in degrees; B is the link position, joint A plus joint B
+    double arm_a = 0.0, arm_b = 0.0;
+
+    // The command being run, one step at a time
+    std::deque<Command> queue;
+    bool running = false;
+    Command current;
+    size_t current_step = 0;
+    double step_start = 0.0, step_end = 0.0;
+    double from_a = 0.0, from_b = 0.0, to_a = 0.0, to_b = 0.0;
+
+    // SetpointFollower: eases from previous to latest over interval
+    bool stream_fresh = false;
+    double stream_received = 0.0, stream_interval = 0.02;
+    double prev_a = 0.0, prev_b = 0.0, latest_a = 0.0, latest_b = 0.0;
+
+    double delay() {
+        if (options.jitter <= 0.0)
+            return options.latency;
+        return options.latency + std::uniform_real_distribution<double>(0.0, options.jitter)(random);
+    }
+
+    bool chance(double p) {
+        return p > 0.0 && std::uniform_real_distribution<double>(0.0, 1.0)(random) < p;
+    }
+
+    void sendNow(const std::string& line) {
+        std::string data = line + "\n";
+        if (::send(client, data.data(), data.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(data.size()))
+            close("send failed");
+    }
+
+    void send(std::string line) {
+        last_due = std::max(last_due, now() + delay());
+        outgoing.push_back({last_due, std::move(line)});
+    }
+
+    void receive(Incoming item) {
+        item.due = now() + delay();
+        incoming.push_back(std::move(item));
+    }
+
+    void readable() {
+        char buffer[4096];
+        ssize_t n = ::recv(client, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            close(n == 0 ? "Pi disconnected" : "read error");
+            return;
+        }
+        input.append(buffer, static_cast<size_t>(n));
+        while (client >= 0 && (binary ? parseFrame() : parseLine())) {}
+    }
+
+    bool parseLine() {
+        size_t end = input.find('\n');
+        if (end == std::string::npos)
+            return false;
+        std::string line = input.substr(0, end);
+        input.erase(0, end + 1);
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+            line.pop_back();
+
+        if (handshake) {
+            handshake = false;
+            if (!options.legacy && line.compare(0, 6, "PROTO ") == 0 && line.find("SEQ") != std::string::npos) {
+                binary = line.find("BIN1") != std::string::npos;
+                sendNow(line);
+                std::cout << "Sequenced protocol, " << (binary ? "binary" : "text") << " commands\n";
+                return true;
+            }
+            std::cout << "Legacy protocol\n";
+            legacy = true;
+        }
+
+        Incoming item;
+        if (line == "STOP") {
+            item.kind = Incoming::Stop;
+        } else if (line == "SHUTDOWN") {
+            item.kind = Incoming::Shutdown;
+        } else if (!legacy && (line.compare(0, 3, "SP ") == 0 || line.compare(0, 4, "VEL ") == 0)) {
+            item.kind = Incoming::Stream;
+            item.step.op = line[0] == 'S' ? Ev3Op::Setpoint : Ev3Op::Velocity;
+            if (std::sscanf(line.c_str() + line.find(' '), "%lf %lf", &item.step.a, &item.step.b) != 2)
+                return true;
+        } else if (legacy) {
+            // One step, no sequence number, answered with a bare OK
+            Ev3Step step;
+            if (parseTextStep(line, step))
+                item.command.steps.push_back(step);
+            else
+                item.command.error = "Unknown command";
+        } else {
+            size_t space = line.find(' ');
+            if (space == std::string::npos) {
+                send("ERR 0 malformed");
+                return true;
+            }
+            item.command.seq = line.substr(0, space);
+            std::string body = line.substr(space + 1);
+            if (body.compare(0, 4, "PLAN") == 0)
+                body.erase(0, 4);
+            std::istringstream steps(body);
+            std::string text;
+            while (std::getline(steps, text, ';')) {
+                if (text.find_first_not_of(' ') == std::string::npos)
+                    continue;
+                Ev3Step step;
+                if (!parseTextStep(text, step))
+                    item.command.error = "Unknown command";
+                item.command.steps.push_back(step);
+            }
+        }
+        receive(std::move(item));
+        return true;
+    }
+
+    bool parseFrame() {
+        // Skip to the next magic byte if we lost sync
+        size_t magic = input.find(static_cast<char>(ev3_frame_magic));
+        input.erase(0, magic == std::string::npos ? input.size() : magic);
+        if (input.size() < ev3_frame_header)
+            return false;
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(input.data());
+        size_t length = p[8] | p[9] << 8;
+        size_t total = ev3_frame_header + length + ev3_frame_trailer;
+        if (input.size() < total)
+            return false;
+
+        Ev3Op op = static_cast<Ev3Op>(p[2]);
+        uint8_t count = p[3];
+        uint32_t seq = static_cast<uint32_t>(getI32(p + 4));
+        uint16_t crc = static_cast<uint16_t>(p[total - 2] | p[total - 1] << 8);
+        const uint8_t* payload = p + ev3_frame_header;
+
+        Incoming item;
+        item.command.seq = std::to_string(seq);
+        if (p[1] != ev3_frame_version || crc != crc16_ccitt(p, total - ev3_frame_trailer)) {
+            ++stats.bad_frames;
+            send("ERR " + item.command.seq + " bad frame");
+            input.erase(0, total);
+            return true;
+        }
+
+        if (op == Ev3Op::Stop) {
+            item.kind = Incoming::Stop;
+        } else if (op == Ev3Op::Shutdown) {
+            item.kind = Incoming::Shutdown;
+        } else if ((op == Ev3Op::Setpoint || op == Ev3Op::Velocity) && length >= 8) {
+            item.kind = Incoming::Stream;
+            item.step = {op, getI32(payload) / 1000.0, getI32(payload + 4) / 1000.0};
+        } else if (op == Ev3Op::Plan) {
+            size_t offset = 0;
+            for (int i = 0; i < count && item.command.error.empty(); ++i) {
+                Ev3Step step;
+                size_t used = offset < length ? decodeStep(static_cast<Ev3Op>(payload[offset]), payload + offset + 1,
+                                                           length - offset - 1, step) : 0;
+                if (used == 0)
+                    item.command.error = "bad step " + std::to_string(i);
+                item.command.steps.push_back(step);
+                offset += 1 + used;
+            }
+        } else {
+            Ev3Step step;
+            if (decodeStep(op, payload, length, step) == 0)
+                item.command.error = "opcode " + std::to_string(static_cast<int>(op));
+            item.command.steps.push_back(step);
+        }
+        input.erase(0, total);
+        receive(std::move(item));
+        return true;
+    }
+
+    void apply(Incoming& item) {
+        switch (item.kind) {
+            case Incoming::Run:
+                ++stats.commands;
+                stats.steps += item.command.steps.size();
+                queue.push_back(std::move(item.command));
+                break;
+            case Incoming::Stop:
+                // Ends the running command and everything queued, each reported as stopped
+                stream_fresh = false;
+                if (legacy)
+                    break;
+                if (running) {
+                    finish("stopped");
+                    running = false;
+                }
+                for (auto& command : queue) {
+                    ++stats.stopped;
+                    send("ERR " + command.seq + " stopped");
+                }
+                queue.clear();
+                break;
+            case Incoming::Shutdown:
+                // The real script drives home first; that isn't worth waiting for here
+                arm_a = arm_b = 0.0;
+                sendNow("Shutting down EV3.");
+                close("shutdown");
+                break;
+            case Incoming::Stream:
+                stream(item.step);
+                break;
+        }
+    }
+
+    void stream(const Ev3Step& step) {
+        double t = now();
+        bool restart = !stream_fresh || t - stream_received > 0.5;
+        double start_a = arm_a, start_b = arm_b;
+        if (!restart) {
+            followerTarget(t, start_a, start_b);
+            stream_interval = std::clamp(t - stream_received, 0.01, 0.2);
+        }
+        prev_a = start_a;
+        prev_b = start_b;
+        if (step.op == Ev3Op::Setpoint) {
+            ++stats.setpoints;
+            latest_a = step.a;
+            latest_b = step.a + step.b;     // m2 is rotationally linked to m1
+        } else {
+            ++stats.velocities;
+            if (restart) {
+                char pos[64];
+                std::snprintf(pos, sizeof(pos), "POS %.2f %.2f", arm_a, arm_b - arm_a);
+                send(pos);
+            }
+            latest_a = start_a + step.a * stream_interval;
+            latest_b = start_b + (step.a + step.b) * stream_interval;
+        }
+        stream_received = t;
+        stream_fresh = true;
+    }
+
+    void followerTarget(double t, double& a, double& b) const {
+        double progress = std::clamp((t - stream_received) / stream_interval, 0.0, 1.0);
+        a = prev_a + (latest_a - prev_a) * progress;
+        b = prev_b + (latest_b - prev_b) * progress;
+    }
+
+    // Moves both motors towards a target, no faster than they can turn
+    void follow(double target_a, double target_b, double dt) {
+        double step_a = options.speed_a * dt, step_b = options.speed_b * dt;
+        arm_a += std::clamp(target_a - arm_a, -step_a, step_a);
+        arm_b += std::clamp(target_b - arm_b, -step_b, step_b);
+    }
+
+    void beginStep(double t) {
+        const Ev3Step& step = current.steps[current_step];
+        step_start = t;
+        from_a = to_a = arm_a;
+        from_b = to_b = arm_b;
+        if (step.op == Ev3Op::Motor) {
+            to_a = step.a;
+            to_b = step.a + step.b;     // m2 is rotationally linked to m1
+            double duration = std::max(std::abs(to_a - from_a) / options.speed_a,
+                                       std::abs(to_b - from_b) / options.speed_b);
+            step_end = t + duration + options.settle;
+        } else {
+            step_end = t + options.grab_time;
+        }
+    }
+
+    void finish(const std::string& error) {
+        ++completed;
+        std::string seq = legacy ? "" : current.seq + " ";
+        if (error == "stopped") {
+            ++stats.stopped;
+            send("ERR " + seq + error);
+        } else if (chance(options.drop)) {
+            ++stats.dropped;
+        } else if (!error.empty() || chance(options.fail)) {
+            ++stats.failed;
+            std::string message = error.empty() ? "simulated failure" : error;
+            send(legacy ? message : "ERR " + seq + message);
+        } else {
+            ++stats.ok;
+            send(legacy ? "OK" : "OK " + current.seq);
+        }
+    }
+
+    void tick() {
+        double t = now();
+        double dt = std::min(t - last_tick, 0.1);
+        last_tick = t;
+
+        while (client >= 0 && !incoming.empty() && incoming.front().due <= t) {
+            Incoming item = std::move(incoming.front());
+            incoming.pop_front();
+            apply(item);
+        }
+        if (client < 0)
+            return;
+
+        if (!running && !queue.empty()) {
+            current = std::move(queue.front());
+            queue.pop_front();
+            stream_fresh = false;
+            running = true;
+            current_step = 0;
+            if (!current.error.empty() || current.steps.empty()) {
+                finish(current.error.empty() ? "empty" : current.error);
+                running = false;
+            } else {
+                beginStep(t);
+            }
+        }
+
+        if (running) {
+            double duration = step_end - step_start - (current.steps[current_step].op == Ev3Op::Motor ? options.settle : 0.0);
+            double progress = duration > 0.0 ? std::clamp((t - step_start) / duration, 0.0, 1.0) : 1.0;
+            arm_a = from_a + (to_a - from_a) * smoothLerp(progress);
+            arm_b = from_b + (to_b - from_b) * smoothLerp(progress);
+            if (t >= step_end && ++current_step == current.steps.size()) {
+                finish("");
+                running = false;
+            } else if (t >= step_end) {
+                beginStep(t);
+            }
+        } else if (stream_fresh && t - stream_received < 0.25) {
+            double target_a, target_b;
+            followerTarget(t, target_a, target_b);
+            follow(target_a, target_b, dt);
+        }
+
+        while (!outgoing.empty() && outgoing.front().due <= t && client >= 0) {
+            sendNow(outgoing.front().line);
+            outgoing.pop_front();
+        }
+        if (client >= 0 && options.disconnect_after > 0 && completed >= options.disconnect_after && outgoing.empty())
+            close("--disconnect-after reached");
+    }
+};
+
+EventLoop* signal_loop = nullptr;
+
+void onSignal(int) {
+    if (signal_loop)
+        signal_loop->stop();
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        auto number = [&]() { return std::atof(argv[++i]); };
+        if (arg == "--port" && has_value) options.port = static_cast<int>(number());
+        else if (arg == "--speed-a" && has_value) options.speed_a = number();
+        else if (arg == "--speed-b" && has_value) options.speed_b = number();
+        else if (arg == "--grab-time" && has_value) options.grab_time = number();
+        else if (arg == "--settle" && has_value) options.settle = number() / 1000.0;
+        else if (arg == "--latency" && has_value) options.latency = number() / 1000.0;
+        else if (arg == "--jitter" && has_value) options.jitter = number() / 1000.0;
+        else if (arg == "--fail" && has_value) options.fail = number();
+        else if (arg == "--drop" && has_value) options.drop = number();
+        else if (arg == "--disconnect-after" && has_value) options.disconnect_after = static_cast<long>(number());
+        else if (arg == "--seed" && has_value) options.seed = static_cast<unsigned>(number());
+        else if (arg == "--legacy") options.legacy = true;
+        else if (arg == "--once") options.once = true;
+        else return false;
+    }
+    return options.port > 0 && options.port < 65536 && options.speed_a > 0.0 && options.speed_b > 0.0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [options]\n"
+                  << "  --port N              listen port (" << Constants::PORT << ")\n"
+                  << "  --speed-a/--speed-b   motor speeds in deg/s (" << Constants::J1_max_speed << ", "
+                  << Constants::J2_max_speed << ")\n"
+                  << "  --grab-time S         seconds per GRABBER step (1)\n"
+                  << "  --settle MS           pause after every MOTOR (200)\n"
+                  << "  --latency MS          one-way network delay (0)\n"
+                  << "  --jitter MS           extra random delay, uniform (0)\n"
+                  << "  --fail P              chance a command ends with ERR (0)\n"
+                  << "  --drop P              chance a command is never acked (0)\n"
+                  << "  --disconnect-after N  cut the connection after N commands\n"
+                  << "  --legacy              old script: plain RDY, bare OK\n"
+                  << "  --once                exit after the first connection\n"
+                  << "  --seed N              random seed for delays and failures\n";
+        return 1;
+    }
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(static_cast<uint16_t>(options.port));
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+        listen(listener, 1) < 0) {
+        std::perror("ev3_sim: listen");
+        return 1;
+    }
+
+    std::cout << std::unitbuf;  // Status lines appear at once, also when piped
+
+    EventLoop loop;
+    Simulator simulator(loop, options);
+    signal_loop = &loop;
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    loop.add(listener, EPOLLIN, [&](uint32_t) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0)
+            return;
+        if (simulator.connected()) {
+            ::close(fd);    // The EV3 script serves one Pi at a time
+            return;
+        }
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        std::cout << "Pi connected\n";
+        simulator.start(fd);
+    });
+
+    std::cout << "EV3 simulator listening on port " << options.port << "\n";
+    loop.run();
+
+    simulator.close("exiting");
+    ::close(listener);
+    return 0;
+}
@@ -0,0 +1,407 @@
+// File: ws_loadgen.cpp
+//
+// Load generator for the /ws job socket. Sends bursts of motor jobs and
+// reports throughput and the latency from sending a job to its reply
+// (CMP, CNL, UNR or EV3_RSP). Pair it with ev3_sim for runs without the robot.
+//
+// Build : cmake target ws_loadgen, or
+//         g++ -std=c++17 -O2 testing/ws_loadgen.cpp -o ws_loadgen
+//
+// Run   : ./ev3_sim &
+//         ./Raspberry2025 --ev3 localhost:1234 &
+//         ./ws_loadgen --jobs 200 --burst 8 --interval 500
+//
+// Replies carry no job id, so they are matched to jobs in the order sent.
+// That holds as long as every job gets exactly one reply: the default mix
+// alternates moves with grabber jobs so no move is coalesced, and bursts
+// should stay under the job queue capacity. The job counters on /metrics
+// are read before and after the run, and the latencies are flagged when
+// the server coalesced or shed a job. Only the last client to connect to
+// /ws gets replies, so close the web page first.
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+    std::string host = "127.0.0.1";
+    std::string port = "8080";
+    int jobs = 100;
+    int burst = 4;              // Jobs sent back to back
+    int interval_ms = 1000;     // Between the starts of two bursts
+    double timeout = 30.0;      // s to wait for replies after the last job
+    bool grip_only = false;
+};
+
+constexpr double arc_radius = 16.0;     // cm, moves stay on this arc in front of the base
+constexpr double arc_half_angle = 40.0; // deg either side of the y axis
+
+std::string base64(const uint8_t* data, size_t size) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < size; i += 3) {
+        uint32_t chunk = data[i] << 16;
+        if (i + 1 < size) chunk |= data[i + 1] << 8;
+        if (i + 2 < size) chunk |= data[i + 2];
+        out += table[(chunk >> 18) & 63];
+        out += table[(chunk >> 12) & 63];
+        out += i + 1 < size ? table[(chunk >> 6) & 63] : '=';
+        out += i + 2 < size ? table[chunk & 63] : '=';
+    }
+    return out;
+}
+
+// Connected TCP socket, or -1
+int connectTcp(const std::string& host, const std::string& port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0)
+        return -1;
+    int fd = -1;
+    for (addrinfo* a = found; a != nullptr && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    return fd;
+}
+
+// Jobs the server coalesced or shed so far, from /metrics. Those get no
+// reply, so any increase during a run shifts the reply matching.
+struct JobCounters {
+    double coalesced = 0.0;
+    double dropped = 0.0;
+};
+
+bool fetchJobCounters(const std::string& host, const std::string& port, JobCounters& counters) {
+    int fd = connectTcp(host, port);
+    if (fd < 0)
+        return false;
+    std::string request = "GET /metrics HTTP/1.0\r\nHost: " + host + ":" + port + "\r\n\r\n";
+    std::string response;
+    if (::send(fd, request.data(), request.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(request.size())) {
+        pollfd p{fd, POLLIN, 0};
+        char buffer[4096];
+        ssize_t n;
+        while (poll(&p, 1, 5000) > 0 && (n = ::recv(fd, buffer, sizeof(buffer), 0)) > 0)
+            response.append(buffer, static_cast<size_t>(n));
+    }
+    ::close(fd);
+
+    auto value = [&](const char* name, double& out) {
+        std::string key = std::string("\n") + name + " ";
+        size_t at = response.find(key);
+        if (at == std::string::npos)
+            return false;
+        out = std::strtod(response.c_str() + at + key.size(), nullptr);
+        return true;
+    };
+    return value("raspberry_jobs_coalesced_total", counters.coalesced) &&
+           value("raspberry_jobs_dropped_total", counters.dropped);
+}
+
+class WebSocketClient {
+public:
+    ~WebSocketClient() {
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    bool connect(const std::string& host, const std::string& port, const std::string& path) {
+        fd = connectTcp(host, port);
+        if (fd < 0)
+            return false;
+
+        uint8_t key[16];
+        for (auto& byte : key)
+            byte = static_cast<uint8_t>(random());
+        std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + host + ":" + port +
+                              "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: " +
+                              base64(key, sizeof(key)) + "\r\nSec-WebSocket-Version: 13\r\n\r\n";
+        if (!sendAll(request.data(), request.size()))
+            return false;
+
+        // Response headers, anything after them is already frame data
+        size_t end;
+        while ((end = input.find("\r\n\r\n")) == std::string::npos) {
+            if (!fill(5000))
+                return false;
+        }
+        bool upgraded = input.compare(0, 12, "HTTP/1.1 101") == 0;
+        input.erase(0, end + 4);
+        return upgraded;
+    }
+
+    bool sendText(const std::string& text) {
+        return sendFrame(0x1, text);
+    }
+
+    // Next text message, waiting up to timeout_ms; false on timeout or close
+    bool receive(std::string& text, int timeout_ms) {
+        auto deadline = clock_type::now() + std::chrono::milliseconds(timeout_ms);
+        while (true) {
+            while (parseFrame(text)) {
+                if (opcode == 0x1)
+                    return true;
+                if (opcode == 0x9)
+                    sendFrame(0xA, text);   // Ping
+                else if (opcode == 0x8) {
+                    closed = true;
+                    return false;
+                }
+            }
+            int left = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - clock_type::now()).count());
+            if (left <= 0 || !fill(left))
+                return false;
+        }
+    }
+
+    bool isClosed() const { return closed; }
+
+private:
+    int fd = -1;
+    std::string input;
+    uint8_t opcode = 0;
+    bool closed = false;
+    std::mt19937 random{std::random_device{}()};
+
+    bool sendAll(const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+            if (n <= 0)
+                return false;
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // Client frames are always masked
+    bool sendFrame(uint8_t op, const std::string& payload) {
+        std::string frame;
+        frame += static_cast<char>(0x80 | op);
+        if (payload.size() < 126) {
+            frame += static_cast<char>(0x80 | payload.size());
+        } else {
+            frame += static_cast<char>(0x80 | 126);
+            frame += static_cast<char>(payload.size() >> 8);
+            frame += static_cast<char>(payload.size() & 0xFF);
+        }
+        uint8_t mask[4];
+        for (auto& byte : mask)
+            byte = static_cast<uint8_t>(random());
+        frame.append(reinterpret_cast<char*>(mask), 4);
+        for (size_t i = 0; i < payload.size(); ++i)
+            frame += static_cast<char>(payload[i] ^ mask[i % 4]);
+        return sendAll(frame.data(), frame.size());
+    }
+
+    bool fill(int timeout_ms) {
+        pollfd p{fd, POLLIN, 0};
+        if (poll(&p, 1, timeout_ms) <= 0)
+            return false;
+        char buffer[4096];
+        ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            closed = true;
+            return false;
+        }
+        input.append(buffer, static_cast<size_t>(n));
+        return true;
+    }
+
+    // One whole frame from input; the server doesn't fragment short messages
+    bool parseFrame(std::string& payload) {
+        if (input.size() < 2)
+            return false;
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(input.data());
+        size_t header = 2;
+        uint64_t length = p[1] & 0x7F;
+        if (length == 126) {
+            header = 4;
+            if (input.size() < header)
+                return false;
+            length = static_cast<uint64_t>(p[2]) << 8 | p[3];
+        } else if (length == 127) {
+            header = 10;
+            if (input.size() < header)
+                return false;
+            length = 0;
+            for (int i = 2; i < 10; ++i)
+                length = length << 8 | p[i];
+        }
+        if (input.size() < header + length)
+            return false;
+        opcode = p[0] & 0x0F;
+        payload.assign(input, header, static_cast<size_t>(length));
+        input.erase(0, header + static_cast<size_t>(length));
+        return true;
+    }
+};
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--host" && has_value) options.host = argv[++i];
+        else if (arg == "--port" && has_value) options.port = argv[++i];
+        else if (arg == "--jobs" && has_value) options.jobs = std::atoi(argv[++i]);
+        else if (arg == "--burst" && has_value) options.burst = std::atoi(argv[++i]);
+        else if (arg == "--interval" && has_value) options.interval_ms = std::atoi(argv[++i]);
+        else if (arg == "--timeout" && has_value) options.timeout = std::atof(argv[++i]);
+        else if (arg == "--grip-only") options.grip_only = true;
+        else return false;
+    }
+    return options.jobs > 0 && options.burst > 0 && options.interval_ms >= 0;
+}
+
+// Job i of the run: moves along the arc, each followed by a grabber job
+std::string makeJob(int i, bool grip_only) {
+    char text[96];
+    if (grip_only || i % 2 == 1) {
+        std::snprintf(text, sizeof(text), R"({"type":"grip","state":"%s"})", (i / 2) % 2 ? "off" : "on");
+        return text;
+    }
+    // Sweep back and forth so consecutive moves differ
+    int step = (i / 2) % 8;
+    double fraction = (step < 4 ? step : 8 - step) / 4.0;
+    double angle = (-arc_half_angle + 2 * arc_half_angle * fraction) * M_PI / 180.0;
+    std::snprintf(text, sizeof(text), R"({"type":"coords","x":%.2f,"y":%.2f})",
+                  arc_radius * std::sin(angle), arc_radius * std::cos(angle));
+    return text;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty())
+        return 0.0;
+    size_t index = static_cast<size_t>(std::ceil(p * sorted.size())) - 1;
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [options]\n"
+                  << "  --host H        web server (127.0.0.1)\n"
+                  << "  --port P        web server port (8080)\n"
+                  << "  --jobs N        jobs to send (100)\n"
+                  << "  --burst B       jobs per burst (4)\n"
+                  << "  --interval MS   from one burst to the next (1000)\n"
+                  << "  --timeout S     wait for replies after the last job (30)\n"
+                  << "  --grip-only     grabber jobs only, no arm moves\n";
+        return 1;
+    }
+
+    JobCounters before;
+    const bool counted = fetchJobCounters(options.host, options.port, before);
+    if (!counted)
+        std::cerr << "No job counters on /metrics, silent drops go unnoticed\n";
+
+    WebSocketClient ws;
+    if (!ws.connect(options.host, options.port, "/ws")) {
+        std::cerr << "Could not open ws://" << options.host << ":" << options.port << "/ws\n";
+        return 1;
+    }
+
+    std::deque<clock_type::time_point> waiting;     // Send times of jobs without a reply
+    std::vector<double> latencies;                  // ms
+    std::map<std::string, int> replies;
+    int sent = 0;
+    auto start = clock_type::now();
+    auto next_burst = start;
+    auto last_sent = start;
+
+    auto handle = [&](const std::string& text) {
+        if (text != "CMP" && text != "CNL" && text != "UNR" && text != "EV3_RSP")
+            return;     // batch_plan and other reports
+        ++replies[text];
+        if (waiting.empty()) {
+            ++replies["unmatched"];
+            return;
+        }
+        latencies.push_back(std::chrono::duration<double, std::milli>(clock_type::now() - waiting.front()).count());
+        waiting.pop_front();
+    };
+
+    std::string text;
+    while (sent < options.jobs) {
+        for (int i = 0; i < options.burst && sent < options.jobs; ++i, ++sent) {
+            if (!ws.sendText(makeJob(sent, options.grip_only))) {
+                std::cerr << "Connection lost after " << sent << " jobs\n";
+                return 1;
+            }
+            last_sent = clock_type::now();
+            waiting.push_back(last_sent);
+        }
+        next_burst += std::chrono::milliseconds(options.interval_ms);
+        while (true) {
+            int left = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                next_burst - clock_type::now()).count());
+            if (left <= 0 || !ws.receive(text, left))
+                break;
+            handle(text);
+        }
+        if (ws.isClosed()) {
+            std::cerr << "Server closed the connection\n";
+            return 1;
+        }
+    }
+
+    auto deadline = last_sent + std::chrono::milliseconds(static_cast<int>(options.timeout * 1000));
+    while (!waiting.empty()) {
+        int left = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - clock_type::now()).count());
+        if (left <= 0 || !ws.receive(text, left))
+            break;
+        handle(text);
+    }
+    double elapsed = std::chrono::duration<double>(clock_type::now() - start).count();
+
+    std::vector<double> sorted = latencies;
+    std::sort(sorted.begin(), sorted.end());
+    std::printf("jobs sent %d, answered %zu, unanswered %zu in %.2f s\n", sent, latencies.size(), waiting.size(), elapsed);
+    std::printf("throughput %.2f jobs/s\n", latencies.size() / elapsed);
+    std::printf("latency ms  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n", percentile(sorted, 0.50),
+                percentile(sorted, 0.90), percentile(sorted, 0.99), sorted.empty() ? 0.0 : sorted.back());
+    std::printf("replies    ");
+    for (const auto& [type, count] : replies)
+        std::printf(" %s %d", type.c_str(), count);
+    std::printf("\n");
+
+    JobCounters after;
+    if (counted && fetchJobCounters(options.host, options.port, after)) {
+        const double coalesced = after.coalesced - before.coalesced;
+        const double dropped = after.dropped - before.dropped;
+        if (coalesced > 0 || dropped > 0)
+            std::printf("UNRELIABLE: the server coalesced %.0f and shed %.0f jobs without a reply, so later "
+                        "replies were credited to older jobs and the latencies above are inflated\n",
+                        coalesced, dropped);
+    }
+    return waiting.empty() ? 0 : 2;
+}